@@ -0,0 +1,65 @@
+#ifndef LOCALIZATION_ADAPTIVE_BUDGET_H
+#define LOCALIZATION_ADAPTIVE_BUDGET_H
+
+#include <cstddef>
+#include <vector>
+
+#include "localization/scan_matcher.h"
+
+/*
+ * Chooses the registration effort of the next scan from how the previous ones went.
+ *
+ * A scan is easy when it converged with a fitness below easy_fitness and the result
+ * moved less than easy_translation / easy_rotation away from the prediction. After an
+ * easy scan only the finest pyramid level runs, with looser stopping epsilons, an
+ * iteration cap of a few times what the last scan needed and a correspondence distance
+ * shrunk towards the observed correction. After skip_streak easy scans in a row a scan
+ * may take the prediction without matching (at most max_skips in a row, 0 never skips).
+ * Any hard scan brings back the full configured pyramid.
+ */
+class AdaptiveBudget
+{
+public:
+  struct Options
+  {
+    double easy_fitness = 0.05;
+    float easy_translation = 0.1;
+    float easy_rotation = 0.01;
+    int min_iterations = 10;
+    float iteration_margin = 3.0;
+    float min_distance_scale = 0.5;
+    double easy_transformation_epsilon = 1e-6;
+    double easy_fitness_epsilon = 1e-6;
+    int skip_streak = 0;
+    int max_skips = 1;
+  };
+
+  struct Level
+  {
+    float leaf;
+    ScanMatcher::Settings settings;
+  };
+
+  struct Plan
+  {
+    bool skip = false;
+    std::vector<Level> levels;
+  };
+
+  AdaptiveBudget(const Options &options, const std::vector<Level> &pyramid) : options_(options), pyramid_(pyramid) {}
+
+  Plan plan();
+  /* Outcome of the last planned scan; `translation`/`rotation` is how far the result is from the prediction */
+  void report(bool converged, double fitness, float translation, float rotation, int iterations);
+
+  bool easy() const { return streak_ > 0; }
+
+private:
+  Options options_;
+  std::vector<Level> pyramid_;
+  int streak_ = 0, skipped_ = 0;
+  float last_translation_ = 0;
+  int last_iterations_ = 0;
+};
+
+#endif
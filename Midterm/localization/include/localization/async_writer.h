@@ -0,0 +1,50 @@
+#ifndef LOCALIZATION_ASYNC_WRITER_H
+#define LOCALIZATION_ASYNC_WRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "localization/spsc_queue.h"
+
+/*
+ * Writes lines to a file or stdout from a background thread.
+ *
+ * write() hands the line over through a lock-free queue, so the calling thread never
+ * touches the stream; lines are written in batches and flushed only when the queue
+ * runs dry and on close(). Only one thread may call write().
+ */
+class AsyncWriter
+{
+public:
+  explicit AsyncWriter(size_t capacity = 4096) : queue_(capacity) {}
+  ~AsyncWriter() { close(); }
+
+  AsyncWriter(const AsyncWriter &) = delete;
+  AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+  /* An empty path writes to stdout; false if the file can not be opened */
+  bool open(const std::string &path);
+  /* Queues one line (without the newline); waits for room if the writer falls behind */
+  void write(std::string line);
+  /* Writes everything still queued, flushes and stops the thread */
+  void close();
+
+  bool isOpen() const { return file_ != nullptr; }
+
+private:
+  void run();
+
+  SpscQueue<std::string> queue_;
+  std::FILE *file_ = nullptr;
+  bool owns_file_ = false;
+  std::thread thread_;
+  std::atomic<bool> stop_{false}, sleeping_{false};
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef LOCALIZATION_BOUNDED_QUEUE_H
+#define LOCALIZATION_BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+/*
+ * Fixed capacity FIFO connecting two pipeline stages.
+ *
+ * When full, push() either blocks until the consumer catches up (Block, every frame is
+ * processed) or evicts the oldest entry (DropOldest, the consumer always gets the newest
+ * data). close() wakes everyone up; pop() keeps draining what is left and then fails.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+  enum Policy
+  {
+    Block,
+    DropOldest
+  };
+
+  BoundedQueue(size_t capacity, Policy policy) : capacity_(capacity > 0 ? capacity : 1), policy_(policy) {}
+
+  /* Returns false if the queue was closed; `dropped` is the number of entries evicted */
+  bool push(T item, size_t *dropped = nullptr)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    size_t evicted = 0;
+    if (policy_ == Block)
+      not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+    if (dropped)
+      *dropped = 0;
+    if (closed_)
+      return false;
+    while (items_.size() >= capacity_)
+    {
+      items_.pop_front();
+      ++evicted;
+    }
+    if (dropped)
+      *dropped = evicted;
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  /* Blocks until an item is available, returns false once closed and empty */
+  bool pop(T &item)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+    if (items_.empty())
+      return false;
+    item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  size_t size() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.size();
+  }
+
+private:
+  const size_t capacity_;
+  const Policy policy_;
+  mutable std::mutex mutex_;
+  std::condition_variable not_empty_, not_full_;
+  std::deque<T> items_;
+  bool closed_ = false;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef LOCALIZATION_FEATURE_MATCHER_H
+#define LOCALIZATION_FEATURE_MATCHER_H
+
+#include <memory>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <pcl/search/kdtree.h>
+
+#include "localization/point_kernels.h"
+#include "localization/scan_features.h"
+#include "localization/scan_matcher.h"
+#include "localization/thread_pool.h"
+
+/*
+ * Feature-based registration (registration: loam): edge and plane points of the scan
+ * against lines and planes fitted to the map once.
+ *
+ * setTarget() fits every map point's `neighbors` nearest points: clearly elongated
+ * neighbourhoods become edges (centroid and direction), flat ones planes (centroid and
+ * normal), the rest is dropped. This runs once per map or submap window, on the
+ * thread that prepares the target, and is shared by clones.
+ *
+ * align() picks a few thousand features from the scan with ScanFeatureExtractor and runs
+ * Gauss-Newton on point-to-line and point-to-plane residuals against the nearest fitted
+ * feature of the same kind, split into fixed chunks on the pool and reduced in chunk
+ * order as in icp_mt. fitness() still measures the whole scan against all map points, so
+ * health check thresholds and the ekf covariance mean the same as for the other backends.
+ */
+class FeatureMatcher : public ScanMatcher
+{
+public:
+  typedef pcl::search::KdTree<pcl::PointXYZI> Tree;
+
+  FeatureMatcher(const std::shared_ptr<ThreadPool> &pool, int neighbors,
+                 const ScanFeatureExtractor::Options &features);
+
+  void setTarget(const Cloud::ConstPtr &target) override;
+  Ptr clone() const override;
+
+  void align(const Cloud::ConstPtr &source, const Eigen::Matrix4f &guess, const Settings &settings) override;
+  bool hasConverged() const override { return converged_; }
+  Eigen::Matrix4f finalTransformation() const override { return final_.cast<float>(); }
+  int iterations() const override { return iterations_; }
+  double fitness(double max_range) override;
+
+  /* Fitted map features and the features of the last aligned scan */
+  size_t mapEdges() const { return map_ ? map_->edges->size() : 0; }
+  size_t mapPlanes() const { return map_ ? map_->planes->size() : 0; }
+  size_t scanEdges() const { return edges_.size(); }
+  size_t scanPlanes() const { return planes_.size(); }
+
+private:
+  typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+  typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+  /* Read-only after setTarget(), shared by clones */
+  struct MapFeatures
+  {
+    Tree::Ptr points;
+    // fitted neighbourhood centroids with their line direction or plane normal
+    Cloud::Ptr edges, planes;
+    std::vector<Eigen::Vector3f> edge_directions, plane_normals;
+    Tree::Ptr edge_tree, plane_tree;
+  };
+
+  /* Normal equations of one chunk of scan features */
+  struct Chunk
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    Matrix6d H;
+    Vector6d b;
+    double rr;
+    size_t count;
+    double inlier_sum;
+    size_t inliers;
+  };
+
+  static const size_t kChunk = 128;
+
+  /* One Gauss-Newton linearization at `T` summed over all chunks */
+  void linearize(const Eigen::Matrix4d &T, float max_distance, Chunk &total);
+
+  std::shared_ptr<ThreadPool> pool_;
+  const int neighbors_;
+  ScanFeatureExtractor extractor_;
+  std::shared_ptr<const MapFeatures> map_;
+
+  Cloud::ConstPtr source_;
+  Cloud edges_, planes_;
+  std::vector<Chunk, Eigen::aligned_allocator<Chunk>> chunks_;
+
+  Eigen::Matrix4d final_ = Eigen::Matrix4d::Identity();
+  bool converged_ = false;
+  int iterations_ = 0;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef LOCALIZATION_HEALTH_MONITOR_H
+#define LOCALIZATION_HEALTH_MONITOR_H
+
+#include <string>
+
+#include <Eigen/Dense>
+
+/*
+ * Judges every registration result before it is trusted.
+ *
+ * A result is rejected when registration did not converge, its fitness is above
+ * max_fitness, fewer than min_inlier_ratio of the scan points found a map neighbour
+ * or it jumped more than max_jump / max_jump_rotation away from the predicted pose.
+ * After max_failures rejections in a row the localizer counts as lost. The jump test is
+ * skipped for the first result after a reset(), when the prediction is the stale pose
+ * of a relocalization or of the initial search.
+ */
+class HealthMonitor
+{
+public:
+  struct Options
+  {
+    double max_fitness = 0.5;
+    double min_inlier_ratio = 0.3;
+    float max_jump = 2.0;
+    float max_jump_rotation = 0.3;
+    int max_failures = 3;
+  };
+
+  explicit HealthMonitor(const Options &options) : options_(options) {}
+
+  /* True if the result is usable, otherwise `reason` says why */
+  bool check(bool converged, double fitness, double inlier_ratio, const Eigen::Matrix4f &predicted,
+             const Eigen::Matrix4f &result, std::string &reason);
+  bool lost() const { return failures_ >= options_.max_failures; }
+  const Options &options() const { return options_; }
+  void reset()
+  {
+    failures_ = 0;
+    fresh_ = true;
+  }
+
+private:
+  Options options_;
+  int failures_ = 0;
+  bool fresh_ = true;
+};
+
+#endif
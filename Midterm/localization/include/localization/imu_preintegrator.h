@@ -0,0 +1,58 @@
+#ifndef LOCALIZATION_IMU_PREINTEGRATOR_H
+#define LOCALIZATION_IMU_PREINTEGRATOR_H
+
+#include <deque>
+#include <mutex>
+
+#include <Eigen/Dense>
+
+/*
+ * Buffers IMU samples by header stamp and integrates them between two scan stamps.
+ *
+ * Each sample is held until the next one (zero-order hold) and integrated over the
+ * measured time between samples, clipped to [from, to]. Samples are added from the IMU
+ * callback and consumed by the matching thread; all methods are thread safe.
+ */
+class ImuPreintegrator
+{
+public:
+  struct Delta
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    Eigen::Matrix3f rotation = Eigen::Matrix3f::Identity(); // orientation at `to` in the frame at `from`
+    Eigen::Vector3f velocity = Eigen::Vector3f::Zero();     // integrated specific force, gravity not removed
+    Eigen::Vector3f position = Eigen::Vector3f::Zero();
+    double dt = 0;
+    int samples = 0;
+  };
+
+  /* `max_latency`: how far the newest sample may lag behind `to` */
+  explicit ImuPreintegrator(double max_latency = 0.05, size_t capacity = 4000)
+      : max_latency_(max_latency), capacity_(capacity)
+  {
+  }
+
+  void add(double stamp, const Eigen::Vector3f &gyro, const Eigen::Vector3f &accel);
+  /*
+   * Integrates from `from` to `to` and drops the samples before `to`.
+   * False if the buffer does not cover the interval.
+   */
+  bool integrate(double from, double to, Delta &delta);
+  /* Mean gyro rate of the samples in [from, to] without consuming them, false if there are none */
+  bool angularVelocity(double from, double to, Eigen::Vector3f &gyro);
+  void clear();
+
+private:
+  struct Sample
+  {
+    double stamp;
+    Eigen::Vector3f gyro, accel;
+  };
+
+  double max_latency_;
+  size_t capacity_;
+  std::mutex mutex_;
+  std::deque<Sample> samples_;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef LOCALIZATION_INITIAL_POSE_SEARCH_H
+#define LOCALIZATION_INITIAL_POSE_SEARCH_H
+
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "localization/scan_matcher.h"
+#include "localization/thread_pool.h"
+
+/*
+ * Multi-hypothesis initial pose search around a position prior (GPS).
+ *
+ * Every yaw in [0, 2pi) at `yaw_step`, combined with every XY offset in
+ * `offsets` (applied on both axes), is aligned with a short coarse registration on a
+ * downsampled scan. The `top_k` best hypotheses are then refined with the full
+ * settings. Hypotheses run in parallelFor on the thread pool, so search() may itself run
+ * as a pool task; each thread uses its own clone of the target matcher so the
+ * precomputed target is shared.
+ * Once any hypothesis scores below `fitness_threshold` no further ones are started.
+ */
+class InitialPoseSearch
+{
+public:
+  typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+  struct Options
+  {
+    float yaw_step = 0.2;
+    std::vector<float> offsets{0.f};
+    float coarse_leaf = 1.0;
+    float coarse_max_distance = 2.0;
+    int coarse_iterations = 30;
+    int top_k = 3;
+    float fine_max_distance = 0.9;
+    int fine_iterations = 1000;
+    float fitness_range = 0.5;
+    float fitness_threshold = 0.05;
+  };
+
+  struct Result
+  {
+    Eigen::Matrix4f pose = Eigen::Matrix4f::Identity();
+    double fitness = -1;
+    int hypotheses = 0;
+  };
+
+  InitialPoseSearch(ThreadPool &pool, const Options &options) : pool_(pool), options_(options) {}
+
+  /* `scan` is in the lidar frame, `matcher` holds the map the pose is searched in */
+  Result search(const Cloud::ConstPtr &scan, const ScanMatcher &matcher, const Eigen::Vector3f &position) const;
+
+private:
+  ThreadPool &pool_;
+  Options options_;
+};
+
+#endif
@@ -0,0 +1,742 @@
+#ifndef LOCALIZATION_LOCALIZER_H
+#define LOCALIZATION_LOCALIZER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <geometry_msgs/PointStamped.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <geometry_msgs/PoseWithCovarianceStamped.h>
+#include <nav_msgs/Odometry.h>
+#include <tf/transform_broadcaster.h>
+#include <tf2_eigen/tf2_eigen.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <sensor_msgs/Imu.h>
+
+#include <Eigen/Dense>
+
+#include <pcl_conversions/pcl_conversions.h>
+#include <pcl_ros/transforms.h>
+
+#include "localization/async_writer.h"
+#include "localization/bounded_queue.h"
+#include "localization/localizer_core.h"
+#include "localization/localizer_ros.h"
+#include "localization/scan_matcher.h"
+#include "localization/stage_stats.h"
+
+/*
+ * ROS front end of LocalizerCore: subscribes to map, scans, gps, imu and ekf, runs the
+ * preprocess -> registration -> output pipeline and publishes poses, tf, csv and
+ * diagnostics. Created by the localizer node and by LocalizerNodelet; callbacks may run
+ * on several threads.
+ */
+class Localizer
+{
+private:
+  ros::NodeHandle _nh;
+  ros::Subscriber sub_map, sub_map_patch, sub_points, sub_gps, sub_imu, sub_ekf; //new sub_imu
+  ros::Publisher pub_points, pub_pose, pub_pose_cov, pub_diagnostics;
+  ros::WallTimer diagnostics_timer;
+  tf::TransformBroadcaster br;
+
+  // preprocessing and registration, see LocalizerCore; the node only moves messages
+  std::unique_ptr<LocalizerCore> core;
+  uint64_t map_signature = 0;
+  ros::Time map_stamp;
+  // tiled map read directly from disk instead of /map, see map_tiler
+  std::string map_tiles_path;
+  std::atomic<bool> gps_ready{false}, map_ready{false};
+
+  // one lidar frame moving through the pipeline
+  struct Frame
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    sensor_msgs::PointCloud2::ConstPtr msg;
+    pcl::PointCloud<pcl::PointXYZI>::Ptr scan;
+    // result.matched is false when the pose is a prediction instead of a registration result
+    LocalizerCore::Result result;
+    Eigen::Matrix<double, 6, 6> covariance;
+    std::chrono::steady_clock::time_point received;
+  };
+  typedef std::shared_ptr<Frame> FramePtr;
+
+  // preprocess -> registration -> output, each stage on its own thread.
+  // offline blocks on full queues so every frame is matched, online drops stale frames
+  std::string pipelineMode;
+  int pipelineQueueDepth = 4;
+  std::unique_ptr<BoundedQueue<FramePtr>> scan_queue, filtered_queue, output_queue;
+  std::thread preprocess_thread, registration_thread, output_thread;
+  std::atomic<size_t> dropped_frames{0};
+
+  // /transformed_points is only for rviz: transformed on its own thread, only while it
+  // has subscribers, at most visualizationRate Hz (0: every frame), keeping every
+  // visualizationDecimation-th point. A slow transform drops frames, never delays poses
+  float visualizationRate = 0;
+  int visualizationDecimation = 1;
+  std::unique_ptr<BoundedQueue<FramePtr>> visualization_queue;
+  std::thread visualization_thread;
+  std::chrono::steady_clock::time_point last_visualization;
+
+  // scans that arrive before map and gps are ready wait here instead of in the pipeline,
+  // at most startupBufferSize of them (oldest dropped first, 0 drops them all)
+  std::mutex gate_mutex;
+  std::deque<FramePtr> startup_frames;
+  bool gate_open = false, releasing = false;
+  int startupBufferSize = 10;
+  int cnt = 0;
+
+  // ekfMode: registration results go to robot_localization as /lidar_pose_cov and its
+  // /ekf/pose output seeds registration, which then only runs every ekfMatchPeriod seconds
+  bool ekfMode = false;
+  float ekfMatchPeriod = 0.0, ekfCovarianceScale = 1.0, ekfMinVariance = 1e-4;
+  std::mutex ekf_mutex;
+  Eigen::Matrix4f ekf_pose; // lidar pose
+  double ekf_stamp = -1;
+  double last_match_stamp = -1;
+
+  std::string result_save_path;
+  // csv rows and per-frame console lines are written by background threads, output_loop()
+  // is the only producer of both. verbosity: 0 warnings, 1 events, 2 one line per frame,
+  // 3 adds the pose matrix and per-message callback logs
+  AsyncWriter result_writer, console;
+  int verbosity = 1;
+  geometry_msgs::Transform car2Lidar;
+  std::string mapFrame, lidarFrame;
+
+  // per-stage latency and registration outcome of the last diagnosticsPeriod, published on
+  // /diagnostics; latency is from pc_callback() to the csv row
+  enum Stage
+  {
+    Convert,
+    Preprocess,
+    Target,
+    Registration,
+    Publish,
+    Csv,
+    Latency
+  };
+  StageStats stage_stats{{"convert", "preprocess", "target", "registration", "publish", "csv", "latency"}};
+  float diagnosticsPeriod = 1.0, diagnosticsMaxLatency = 0.2;
+  std::mutex diagnostics_mutex;
+  int window_frames = 0, window_matched = 0, window_iterations = 0;
+  double window_fitness = 0;
+  size_t reported_dropped = 0;
+
+public:
+  Localizer(ros::NodeHandle nh)
+  {
+    _nh = nh;
+
+    _nh.param<std::string>("result_save_path", result_save_path, "result.csv");
+    _nh.param<std::string>("map_tiles_path", map_tiles_path, "");
+    _nh.param<std::string>("pipelineMode", pipelineMode, "offline");
+    _nh.param<int>("pipelineQueueDepth", pipelineQueueDepth, 4);
+    _nh.param<int>("startupBufferSize", startupBufferSize, 10);
+    _nh.param<bool>("ekfMode", ekfMode, false);
+    _nh.param<float>("ekfMatchPeriod", ekfMatchPeriod, 0.0);
+    _nh.param<float>("ekfCovarianceScale", ekfCovarianceScale, 1.0);
+    _nh.param<float>("ekfMinVariance", ekfMinVariance, 1e-4);
+    _nh.param<std::string>("mapFrame", mapFrame, "world");
+    _nh.param<std::string>("lidarFrame", lidarFrame, "nuscenes_lidar");
+
+    _nh.param<int>("verbosity", verbosity, 1);
+    _nh.param<float>("diagnosticsPeriod", diagnosticsPeriod, 1.0);
+    _nh.param<float>("diagnosticsMaxLatency", diagnosticsMaxLatency, 0.2);
+    _nh.param<float>("visualizationRate", visualizationRate, 0.0);
+    _nh.param<int>("visualizationDecimation", visualizationDecimation, 1);
+
+    ROS_INFO("saving results to %s", result_save_path.c_str());
+    if (!result_writer.open(result_save_path))
+      ROS_ERROR("can not open %s", result_save_path.c_str());
+    result_writer.write("id,x,y,z,yaw,pitch,roll");
+    if (verbosity >= 2)
+      console.open("");
+
+    Eigen::Affine3d base_to_lidar;
+    loadBaseToLidar(_nh, base_to_lidar);
+    car2Lidar = tf2::eigenToTransform(base_to_lidar).transform;
+
+    core.reset(new LocalizerCore(loadLocalizerOptions(_nh)));
+    if (!map_tiles_path.empty() && core->openTiles(map_tiles_path))
+      set_ready(map_ready);
+    else
+    {
+      if (!map_tiles_path.empty())
+        ROS_ERROR("waiting for /map instead");
+      sub_map = _nh.subscribe("/map", 1, &Localizer::map_callback, this);
+      // partial map updates, merged without rebuilding the whole target
+      sub_map_patch = _nh.subscribe("/map_patch", 4, &Localizer::map_patch_callback, this);
+    }
+    bool online = pipelineMode == "online";
+    if (!online && pipelineMode != "offline")
+      ROS_ERROR("unknown pipelineMode '%s', using offline", pipelineMode.c_str());
+    typedef BoundedQueue<FramePtr> Queue;
+    Queue::Policy policy = online ? Queue::DropOldest : Queue::Block;
+    size_t depth = online ? 1 : std::max(1, pipelineQueueDepth);
+    scan_queue.reset(new Queue(depth, policy));
+    filtered_queue.reset(new Queue(depth, policy));
+    // results are never dropped, every matched frame reaches the csv
+    output_queue.reset(new Queue(std::max(1, pipelineQueueDepth), Queue::Block));
+    preprocess_thread = std::thread(&Localizer::preprocess_loop, this);
+    registration_thread = std::thread(&Localizer::registration_loop, this);
+    output_thread = std::thread(&Localizer::output_loop, this);
+    visualization_queue.reset(new Queue(1, Queue::DropOldest));
+    visualization_thread = std::thread(&Localizer::visualization_loop, this);
+
+    // offline keeps the bag backlog in the subscriber, online only the newest scan
+    sub_points = _nh.subscribe("/lidar_points", online ? 1 : 400, &Localizer::pc_callback, this);
+    sub_gps = _nh.subscribe("/gps", 1, &Localizer::gps_callback, this);
+    sub_imu = nh.subscribe("/imu/data", 200, &Localizer::imu_callback, this); // every sample is integrated, do not drop them
+    pub_points = _nh.advertise<sensor_msgs::PointCloud2>("/transformed_points", 1);
+    pub_pose = _nh.advertise<geometry_msgs::PoseStamped>("/lidar_pose", 1);
+    if (ekfMode)
+    {
+      pub_pose_cov = _nh.advertise<geometry_msgs::PoseWithCovarianceStamped>("/lidar_pose_cov", 10);
+      sub_ekf = _nh.subscribe("/ekf/pose", 10, &Localizer::ekf_callback, this);
+    }
+    if (diagnosticsPeriod > 0)
+    {
+      pub_diagnostics = _nh.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
+      // wall time, lag behind the sensor matters even when the bag is replayed slowly
+      diagnostics_timer =
+          _nh.createWallTimer(ros::WallDuration(diagnosticsPeriod), &Localizer::diagnostics_callback, this);
+    }
+    ROS_INFO("%s initialized", ros::this_node::getName().c_str());
+  }
+
+  // Gentaly end the node
+  ~Localizer()
+  {
+    // no callbacks past this point: shutdown() waits for running ones, which may touch
+    // core, on a multithreaded queue (nodelet) the spinner keeps going during unload
+    sub_points.shutdown();
+    sub_map.shutdown();
+    sub_map_patch.shutdown();
+    sub_gps.shutdown();
+    sub_imu.shutdown();
+    sub_ekf.shutdown();
+    diagnostics_timer.stop();
+    // drain the pipeline stage by stage so queued frames still get written
+    scan_queue->close();
+    preprocess_thread.join();
+    filtered_queue->close();
+    registration_thread.join();
+    output_queue->close();
+    output_thread.join();
+    visualization_queue->close();
+    visualization_thread.join();
+    // waits for a running relocalization
+    core.reset();
+
+    result_writer.close();
+    console.close();
+  }
+
+  void map_callback(const sensor_msgs::PointCloud2::ConstPtr &msg)
+  {
+    ROS_INFO("Got map message");
+
+    // pub_map stamps each map version, a known stamp skips the map without touching it
+    if (map_ready && !msg->header.stamp.isZero() && msg->header.stamp == map_stamp)
+    {
+      ROS_INFO("map version unchanged, skip");
+      return;
+    }
+
+    // publishers without a version stamp may still re-send the same cloud
+    uint64_t signature = cloud_signature(*msg);
+    if (map_ready && signature == map_signature)
+    {
+      ROS_INFO("map unchanged, skip");
+      map_stamp = msg->header.stamp;
+      return;
+    }
+
+    pcl::PointCloud<pcl::PointXYZI>::Ptr map_points(new pcl::PointCloud<pcl::PointXYZI>);
+    pcl::fromROSMsg(*msg, *map_points);
+    core->setMap(*map_points);
+    map_signature = signature;
+    map_stamp = msg->header.stamp;
+    set_ready(map_ready);
+  }
+
+  void map_patch_callback(const sensor_msgs::PointCloud2::ConstPtr &msg)
+  {
+    pcl::PointCloud<pcl::PointXYZI> patch;
+    pcl::fromROSMsg(*msg, patch);
+    if (!core->mergeMap(patch))
+      ROS_WARN("map patch of %zu points not merged", patch.size());
+  }
+
+  /* FNV-1a style hash over the cloud layout and payload, taken 8 bytes at a time */
+  static uint64_t cloud_signature(const sensor_msgs::PointCloud2 &cloud)
+  {
+    uint64_t h = 1469598103934665603ULL;
+    auto mix = [&h](uint64_t v) {
+      h ^= v;
+      h *= 1099511628211ULL;
+    };
+    mix(cloud.width);
+    mix(cloud.height);
+    mix(cloud.point_step);
+    const uint8_t *data = cloud.data.data();
+    const size_t size = cloud.data.size();
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+      uint64_t word;
+      std::memcpy(&word, data + i, sizeof(word));
+      mix(word);
+    }
+    // the tail bytes, zero padded; the length tells them from padding
+    if (i < size)
+    {
+      uint64_t tail = 0;
+      std::memcpy(&tail, data + i, size - i);
+      mix(tail);
+    }
+    mix(size);
+    return h;
+  }
+
+  void pc_callback(const sensor_msgs::PointCloud2::ConstPtr &msg)
+  {
+    if (verbosity >= 3)
+      ROS_INFO("Got lidar message");
+    FramePtr frame(new Frame);
+    frame->msg = msg;
+    frame->received = std::chrono::steady_clock::now();
+    {
+      std::lock_guard<std::mutex> lock(gate_mutex);
+      if (!gate_open)
+      {
+        ROS_WARN("waiting for map and gps data ...");
+        startup_frames.push_back(frame);
+        while (startup_frames.size() > static_cast<size_t>(std::max(0, startupBufferSize)))
+        {
+          startup_frames.pop_front();
+          ++dropped_frames;
+        }
+        return;
+      }
+    }
+    enqueue_scan(frame);
+  }
+
+  void enqueue_scan(const FramePtr &frame)
+  {
+    size_t dropped = 0;
+    scan_queue->push(frame, &dropped);
+    dropped_frames += dropped;
+  }
+
+  /*
+   * Marks map or gps ready and, once both are, releases the buffered scans in order.
+   * They are pushed outside the gate lock, a blocking scan queue would otherwise stall
+   * pc_callback on it; the gate stays closed until the buffer is drained, so scans that
+   * arrive meanwhile are buffered behind them and no scan overtakes a buffered one.
+   */
+  void set_ready(std::atomic<bool> &flag)
+  {
+    {
+      std::lock_guard<std::mutex> lock(gate_mutex);
+      flag = true;
+      if (!(gps_ready && map_ready) || gate_open || releasing)
+        return;
+      releasing = true;
+    }
+    std::deque<FramePtr> frames;
+    while (true)
+    {
+      {
+        std::lock_guard<std::mutex> lock(gate_mutex);
+        if (startup_frames.empty())
+        {
+          gate_open = true;
+          releasing = false;
+          return;
+        }
+        frames.swap(startup_frames);
+      }
+      ROS_INFO("map and gps ready, releasing %zu buffered scans", frames.size());
+      for (const FramePtr &frame : frames)
+        enqueue_scan(frame);
+      frames.clear();
+    }
+  }
+
+  /* Stage 1: decode, crop, deskew and downsample */
+  void preprocess_loop()
+  {
+    FramePtr frame;
+    while (scan_queue->pop(frame))
+    {
+      if (verbosity >= 3)
+        ROS_INFO("point size: %d", frame->msg->width * frame->msg->height);
+
+      /* [Part 1] Perform pointcloud preprocessing here e.g. downsampling use setLeafSize(...) ... */
+      /* the map side is downsampled once in LocalizerCore::setMap() */
+      frame->scan = core->acquireScan();
+      double stamp = frame->msg->header.stamp.toSec();
+      RawCloudView view;
+      pcl::PointCloud<pcl::PointXYZI>::Ptr scan_ptr;
+      {
+        // voxelize while reading the message buffer, no intermediate cloud unless the layout is unsupported
+        ScopedStageTimer timer(stage_stats, Convert);
+        if (!rawCloudView(*frame->msg, view))
+        {
+          scan_ptr = core->acquireScan();
+          pcl::fromROSMsg(*frame->msg, *scan_ptr);
+          view = RawCloudView::fromCloud(*scan_ptr);
+        }
+      }
+      {
+        ScopedStageTimer timer(stage_stats, Preprocess);
+        core->preprocess(view, stamp, *frame->scan);
+      }
+
+      size_t dropped = 0;
+      filtered_queue->push(frame, &dropped);
+      dropped_frames += dropped;
+    }
+  }
+
+  /* Stage 2: scan matching, the only stage calling LocalizerCore::align() */
+  void registration_loop()
+  {
+    // frames only enter the pipeline once map and gps are ready, see set_ready()
+    FramePtr frame;
+    while (filtered_queue->pop(frame))
+    {
+      double stamp = frame->msg->header.stamp.toSec();
+      Eigen::Matrix4f ekf_guess;
+      bool ekf_seeded = ekfMode && ekf_prediction(stamp, ekf_guess);
+      if (ekf_seeded && core->initialized() && stamp - last_match_stamp < ekfMatchPeriod)
+      {
+        // between matches the EKF carries the pose
+        frame->result.pose = ekf_guess;
+        output_queue->push(frame);
+        continue;
+      }
+
+      /* [Part 2] Perform ICP here or any other scan-matching algorithm, see LocalizerCore::align() */
+      frame->result = core->align(frame->scan, stamp, ekf_seeded ? &ekf_guess : nullptr);
+      stage_stats.add(Target, frame->result.target_time);
+      if (frame->result.iterations > 0)
+        stage_stats.add(Registration, frame->result.registration_time);
+      if (!frame->result.matched)
+      {
+        output_queue->push(frame);
+        continue;
+      }
+      last_match_stamp = stamp;
+      if (ekfMode)
+      {
+        frame->covariance =
+            ekfCovarianceScale * registrationCovariance(*frame->scan, frame->result.pose, frame->result.fitness);
+        for (int k = 0; k < 6; ++k)
+          frame->covariance(k, k) = std::max<double>(frame->covariance(k, k), ekfMinVariance);
+      }
+      output_queue->push(frame);
+    }
+  }
+
+  /* Latest EKF lidar pose if it is recent enough to stand in for the scan at `stamp` */
+  bool ekf_prediction(double stamp, Eigen::Matrix4f &pose)
+  {
+    std::lock_guard<std::mutex> lock(ekf_mutex);
+    // robot_localization publishes at 10 Hz or more, an older pose means it stalled
+    if (ekf_stamp < 0 || std::abs(stamp - ekf_stamp) > 0.5)
+      return false;
+    pose = ekf_pose;
+    return true;
+  }
+
+  void ekf_callback(const nav_msgs::Odometry::ConstPtr &msg)
+  {
+    // a filter running in another world_frame would seed registration in the wrong frame
+    if (!msg->header.frame_id.empty() && msg->header.frame_id != mapFrame)
+    {
+      ROS_WARN_THROTTLE(5, "ekf pose in %s, expected %s (world_frame), ignored", msg->header.frame_id.c_str(),
+                        mapFrame.c_str());
+      return;
+    }
+    // robot_localization tracks base_link, registration works on the lidar pose
+    const geometry_msgs::Pose &p = msg->pose.pose;
+    Eigen::Affine3d base = Eigen::Translation3d(p.position.x, p.position.y, p.position.z) *
+                           Eigen::Quaterniond(p.orientation.w, p.orientation.x, p.orientation.y, p.orientation.z);
+    Eigen::Affine3d lidar = base * tf2::transformToEigen(car2Lidar);
+    std::lock_guard<std::mutex> lock(ekf_mutex);
+    ekf_pose = lidar.matrix().cast<float>();
+    ekf_stamp = msg->header.stamp.toSec();
+  }
+
+  /* Stage 3: publishing, tf and csv */
+  void output_loop()
+  {
+    FramePtr frame;
+    while (output_queue->pop(frame))
+    {
+      {
+        ScopedStageTimer timer(stage_stats, Publish);
+        publish_result(frame->msg, frame->result.pose);
+        if (wants_visualization())
+          visualization_queue->push(frame);
+        if (ekfMode && frame->result.matched)
+          publish_measurement(*frame);
+      }
+      {
+        ScopedStageTimer timer(stage_stats, Csv);
+        write_result(frame->result.pose);
+      }
+      stage_stats.add(Latency, std::chrono::duration<double>(std::chrono::steady_clock::now() - frame->received).count());
+      {
+        std::lock_guard<std::mutex> lock(diagnostics_mutex);
+        ++window_frames;
+        if (frame->result.matched)
+        {
+          ++window_matched;
+          window_fitness += frame->result.fitness;
+          window_iterations += frame->result.iterations;
+        }
+      }
+      if (verbosity >= 2)
+        log_frame(*frame);
+    }
+  }
+
+  /* Stage latencies, registration outcome, drops and queue depths of the last period */
+  void diagnostics_callback(const ros::WallTimerEvent &)
+  {
+    std::vector<LatencyHistogram> window = stage_stats.takeWindow();
+    int frames, matched, iterations;
+    double fitness;
+    {
+      std::lock_guard<std::mutex> lock(diagnostics_mutex);
+      frames = window_frames;
+      matched = window_matched;
+      iterations = window_iterations;
+      fitness = window_fitness;
+      window_frames = window_matched = window_iterations = 0;
+      window_fitness = 0;
+    }
+    size_t dropped = dropped_frames;
+    size_t new_drops = dropped - reported_dropped;
+    reported_dropped = dropped;
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = "localizer: pipeline";
+    status.hardware_id = lidarFrame;
+    auto value = [&status](const std::string &key, const std::string &text) {
+      diagnostic_msgs::KeyValue kv;
+      kv.key = key;
+      kv.value = text;
+      status.values.push_back(kv);
+    };
+    char text[160];
+    std::snprintf(text, sizeof(text), "%.1f", frames / diagnosticsPeriod);
+    value("rate [Hz]", text);
+    value("frames", std::to_string(frames));
+    value("matched", std::to_string(matched));
+    std::snprintf(text, sizeof(text), "%g", matched ? fitness / matched : 0.);
+    value("fitness", text);
+    std::snprintf(text, sizeof(text), "%.1f", matched ? static_cast<double>(iterations) / matched : 0.);
+    value("iterations", text);
+    value("dropped frames", std::to_string(new_drops) + " (" + std::to_string(dropped) + " total)");
+    value("queue depth", std::to_string(scan_queue->size()) + " / " + std::to_string(filtered_queue->size()) + " / " +
+                             std::to_string(output_queue->size()));
+    for (size_t i = 0; i < window.size(); ++i)
+    {
+      const LatencyHistogram &h = window[i];
+      std::snprintf(text, sizeof(text), "mean %.2f p50 %.2f p90 %.2f p99 %.2f max %.2f", h.mean() * 1e3,
+                    h.percentile(0.5) * 1e3, h.percentile(0.9) * 1e3, h.percentile(0.99) * 1e3, h.max() * 1e3);
+      value(stage_stats.names()[i] + " [ms]", text);
+    }
+
+    double latency = window[Latency].percentile(0.9);
+    status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    if (new_drops > 0)
+      status.message = "dropping frames";
+    else if (latency > diagnosticsMaxLatency)
+      status.message = "lagging behind the sensor";
+    else if (frames > 0 && matched == 0)
+      status.message = "no registration results";
+    else
+    {
+      status.level = diagnostic_msgs::DiagnosticStatus::OK;
+      status.message = frames > 0 ? "ok" : "no scans";
+    }
+
+    diagnostic_msgs::DiagnosticArray array;
+    array.header.stamp = ros::Time::now();
+    array.status.push_back(status);
+    pub_diagnostics.publish(array);
+  }
+
+  void log_frame(const Frame &frame)
+  {
+    const LocalizerCore::Result &result = frame.result;
+    char line[160];
+    if (result.iterations == 0)
+      std::snprintf(line, sizeof(line), "%d %.3f: %s", cnt, frame.msg->header.stamp.toSec(),
+                    result.matched ? "matched" : "prediction");
+    else
+      std::snprintf(line, sizeof(line), "%d %.3f: %s, %d iterations on %d levels, fitness %g%s", cnt,
+                    frame.msg->header.stamp.toSec(), result.converged ? "converged" : "not converged",
+                    result.iterations, result.levels, result.fitness, result.matched ? "" : ", rejected");
+    console.write(line);
+    if (verbosity >= 3)
+    {
+      const Eigen::Matrix4f &m = result.pose;
+      for (int r = 0; r < 4; ++r)
+      {
+        std::snprintf(line, sizeof(line), "%10.4f %10.4f %10.4f %10.4f", m(r, 0), m(r, 1), m(r, 2), m(r, 3));
+        console.write(line);
+      }
+    }
+  }
+
+  /* Only called by output_loop(); true when /transformed_points is due for this frame */
+  bool wants_visualization()
+  {
+    if (pub_points.getNumSubscribers() == 0)
+      return false;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (visualizationRate > 0 && now - last_visualization < std::chrono::duration<double>(1. / visualizationRate))
+      return false;
+    last_visualization = now;
+    return true;
+  }
+
+  /* Side thread: /transformed_points, the newest pending frame only */
+  void visualization_loop()
+  {
+    FramePtr frame;
+    while (visualization_queue->pop(frame))
+    {
+      sensor_msgs::PointCloud2::Ptr out_msg(new sensor_msgs::PointCloud2);
+      size_t stride = static_cast<size_t>(std::max(1, visualizationDecimation));
+      if (!transformCloud(frame->result.pose, *frame->msg, *out_msg, stride))
+        pcl_ros::transformPointCloud(frame->result.pose, *frame->msg, *out_msg);
+      out_msg->header = frame->msg->header;
+      out_msg->header.frame_id = mapFrame;
+      pub_points.publish(out_msg);
+      // do not keep the scan buffer alive until the next frame
+      frame.reset();
+    }
+  }
+
+  void publish_result(const sensor_msgs::PointCloud2::ConstPtr &msg, const Eigen::Matrix4f &result)
+  {
+    //Publish odometry msg to /world
+    // float x, y, z, roll1, pitch1, yaw1;
+    // pcl::getTranslationAndEulerAngles(tROTA, x, y, z, roll1, pitch1, yaw1);
+
+    // broadcast transforms
+    tf::Matrix3x3 rot;
+    rot.setValue(
+        static_cast<double>(result(0, 0)), static_cast<double>(result(0, 1)), static_cast<double>(result(0, 2)),
+        static_cast<double>(result(1, 0)), static_cast<double>(result(1, 1)), static_cast<double>(result(1, 2)),
+        static_cast<double>(result(2, 0)), static_cast<double>(result(2, 1)), static_cast<double>(result(2, 2)));
+    tf::Vector3 trans(result(0, 3), result(1, 3), result(2, 3));
+    tf::Transform transform(rot, trans);
+    br.sendTransform(tf::StampedTransform(transform.inverse(), msg->header.stamp, lidarFrame, mapFrame));
+
+    // publish lidar pose
+    geometry_msgs::PoseStamped pose;
+    pose.header = msg->header;
+    pose.header.frame_id = mapFrame;
+    pose.pose.position.x = trans.getX();
+    pose.pose.position.y = trans.getY();
+    pose.pose.position.z = trans.getZ();
+    pose.pose.orientation.x = transform.getRotation().getX();
+    pose.pose.orientation.y = transform.getRotation().getY();
+    pose.pose.orientation.z = transform.getRotation().getZ();
+    pose.pose.orientation.w = transform.getRotation().getW();
+    pub_pose.publish(pose);
+  }
+
+  /* Csv row of the base_link pose */
+  void write_result(const Eigen::Matrix4f &result)
+  {
+    Eigen::Affine3d transform_c2l, transform_m2l;
+    transform_m2l.matrix() = result.cast<double>();
+    transform_c2l = (tf2::transformToEigen(car2Lidar));
+    Eigen::Affine3d tf_p = transform_m2l * transform_c2l.inverse();
+    result_writer.write(resultRow(++cnt, tf_p));
+  }
+
+  /* Registration result as a base_link pose measurement for robot_localization */
+  void publish_measurement(const Frame &frame)
+  {
+    Eigen::Affine3d lidar;
+    lidar.matrix() = frame.result.pose.cast<double>();
+    Eigen::Affine3d base = lidar * tf2::transformToEigen(car2Lidar).inverse();
+    Eigen::Quaterniond q(base.rotation());
+
+    geometry_msgs::PoseWithCovarianceStamped measurement;
+    measurement.header = frame.msg->header;
+    measurement.header.frame_id = mapFrame;
+    measurement.pose.pose.position.x = base.translation().x();
+    measurement.pose.pose.position.y = base.translation().y();
+    measurement.pose.pose.position.z = base.translation().z();
+    measurement.pose.pose.orientation.x = q.x();
+    measurement.pose.pose.orientation.y = q.y();
+    measurement.pose.pose.orientation.z = q.z();
+    measurement.pose.pose.orientation.w = q.w();
+    for (int r = 0; r < 6; ++r)
+      for (int c = 0; c < 6; ++c)
+        measurement.pose.covariance[r * 6 + c] = frame.covariance(r, c);
+    pub_pose_cov.publish(measurement);
+  }
+
+  /*imu*/
+  void imu_callback(const sensor_msgs::Imu::ConstPtr& imu_msg)
+  { 
+    if (verbosity >= 3)
+      ROS_INFO("Got imu message");
+    const geometry_msgs::Vector3 &w = imu_msg->angular_velocity, &a = imu_msg->linear_acceleration;
+    core->addImu(imu_msg->header.stamp.toSec(), Eigen::Vector3f(w.x, w.y, w.z), Eigen::Vector3f(a.x, a.y, a.z));
+  }
+
+  void gps_callback(const geometry_msgs::PointStamped::ConstPtr &msg)
+  {
+    if (verbosity >= 3)
+      ROS_INFO("Got GPS message");
+    core->setGps(Eigen::Vector3f(msg->point.x, msg->point.y, msg->point.z));
+
+    if (!core->initialized())
+    {
+      // if(true){
+      geometry_msgs::PoseStamped pose;
+      pose.header = msg->header;
+      pose.pose.position = msg->point;
+      pub_pose.publish(pose);
+      // ROS_INFO("pub pose");
+
+      tf::Matrix3x3 rot;
+      rot.setIdentity();
+      tf::Vector3 trans(msg->point.x, msg->point.y, msg->point.z);
+      tf::Transform transform(rot, trans);
+      br.sendTransform(tf::StampedTransform(transform, msg->header.stamp, "world", "nuscenes_lidar"));
+    }
+
+    set_ready(gps_ready);
+    return;
+  }
+};
+
+#endif
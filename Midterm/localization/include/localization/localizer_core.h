@@ -0,0 +1,210 @@
+#ifndef LOCALIZATION_LOCALIZER_CORE_H
+#define LOCALIZATION_LOCALIZER_CORE_H
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "localization/adaptive_budget.h"
+#include "localization/health_monitor.h"
+#include "localization/imu_preintegrator.h"
+#include "localization/initial_pose_search.h"
+#include "localization/map_tile_store.h"
+#include "localization/pose_predictor.h"
+#include "localization/scan_buffer_pool.h"
+#include "localization/scan_decoder.h"
+#include "localization/scan_matcher.h"
+#include "localization/scan_odometry.h"
+#include "localization/submap_manager.h"
+#include "localization/thread_pool.h"
+
+/*
+ * Map-based lidar localization without ROS: scan preprocessing and scan-to-map
+ * registration, one scan at a time. The localizer node and the offline benchmark both
+ * drive it, so the benchmark measures exactly what runs on the vehicle.
+ *
+ * preprocess() and align() may run on two different threads (the node pipelines them),
+ * but each of them on one thread at a time. setMap(), setGps() and addImu() may be called
+ * from any thread.
+ */
+class LocalizerCore
+{
+public:
+  typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+  enum LogLevel
+  {
+    Info,
+    Warn,
+    Error
+  };
+  typedef std::function<void(LogLevel level, const std::string &message)> Logger;
+
+  struct Options
+  {
+    float scan_leaf = 1.0;
+    float map_leaf = 1.0;
+    // registration levels from coarse to fine, at least one
+    std::vector<AdaptiveBudget::Level> pyramid;
+    // shrink the pyramid after easy scans
+    bool adaptive_budget = false;
+    AdaptiveBudget::Options budget;
+    // local window of the map as target, disabled when submap_radius <= 0
+    float submap_radius = 0.0;
+    float submap_update_distance = 20.0;
+    // the pool is created by the core with `threads` workers (0 all cores) when unset
+    ScanMatcher::Options matcher;
+    int threads = 0;
+    // first scan: a fixed yaw at the gps position, else the multi-hypothesis search
+    bool fixed_init_yaw = false;
+    float init_yaw = 0.0;
+    InitialPoseSearch::Options init_search;
+    InitialPoseSearch::Options relocalization;
+    ScanFilter filter;
+    bool predict_motion = true;
+    PosePredictor::Options predictor;
+    // period, reference and spin direction of the sweep, the twist is filled per scan
+    bool deskew = false;
+    SweepMotion sweep;
+    // reject implausible results and relocalize once lost
+    bool health_check = false;
+    HealthMonitor::Options health;
+    // scan-to-scan odometry every scan, scan-to-map only every odometry.correction_period;
+    // the adaptive budget does not apply then
+    bool scan_odometry = false;
+    ScanOdometry::Options odometry;
+    Eigen::Matrix3f imu_to_lidar = Eigen::Matrix3f::Identity();
+    // messages go to stderr when unset
+    Logger logger;
+  };
+
+  struct Result
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    Eigen::Matrix4f pose = Eigen::Matrix4f::Identity();
+    // false when `pose` is a prediction: skipped, rejected, relocalizing or no target yet
+    bool matched = false;
+    bool converged = false;
+    double fitness = 0;
+    int iterations = 0;
+    int levels = 0;
+    // seconds spent waiting for the target (submap switch) and in registration
+    double target_time = 0;
+    double registration_time = 0;
+  };
+
+  explicit LocalizerCore(const Options &options);
+  ~LocalizerCore();
+
+  LocalizerCore(const LocalizerCore &) = delete;
+  LocalizerCore &operator=(const LocalizerCore &) = delete;
+
+  /* Voxelizes `map` at map_leaf and precomputes the registration target */
+  void setMap(const Cloud &map);
+  /*
+   * Replaces the map over the XY footprint of `patch` (all heights) with the patch.
+   * Incremental targets (icp_ivox) are edited in place, others are rebuilt. False
+   * without an in-memory map to merge into.
+   */
+  bool mergeMap(const Cloud &patch);
+  /* Pages the map in from a map_tiler file instead, false if it can not be opened */
+  bool openTiles(const std::string &path);
+  /* Pages the map in from an open store, which may be shared with other cores */
+  bool openTiles(const MapTileStore::ConstPtr &store);
+  bool hasMap() const { return has_map_; }
+
+  void setGps(const Eigen::Vector3f &position);
+  void addImu(double stamp, const Eigen::Vector3f &gyro, const Eigen::Vector3f &accel);
+
+  /* Crops, deskews and downsamples the raw scan taken at `stamp` into `out` */
+  void preprocess(RawCloudView view, double stamp, Cloud &out);
+  /* Recycled cloud for preprocess() output */
+  Cloud::Ptr acquireScan() { return scan_pool_.acquire(); }
+
+  /*
+   * Registers the preprocessed `scan` taken at `stamp` against the map. A `seed`, such
+   * as an EKF pose, replaces the motion prediction as initial guess.
+   */
+  Result align(const Cloud::Ptr &scan, double stamp, const Eigen::Matrix4f *seed = nullptr);
+
+  bool initialized() const { return initialized_; }
+  const Options &options() const { return options_; }
+  ThreadPool &pool() { return *pool_; }
+
+private:
+  ScanMatcherFactory matcherFactory() const;
+  ScanMatcher::Ptr currentMatcher();
+  void updateTarget(const Eigen::Vector3f &position);
+  bool initialize(const Cloud::Ptr &scan);
+  bool sweepMotion(double stamp, SweepMotion &motion);
+  void startRelocalization(const Cloud::Ptr &scan, double stamp);
+  bool pollRelocalization(double stamp, Eigen::Matrix4f &guess);
+  Eigen::Vector3f gps();
+  Eigen::Matrix4f registerScan(ScanMatcher &matcher, const Cloud::Ptr &scan, Eigen::Matrix4f guess,
+                               const std::vector<AdaptiveBudget::Level> &levels, ScanDecoder &decoder,
+                               Result &result);
+  Result alignOdometry(const Cloud::Ptr &scan, double stamp, const Eigen::Matrix4f &guess);
+  void startCorrection(const ScanMatcher::Ptr &matcher, const Cloud::Ptr &scan, double stamp,
+                       const Eigen::Matrix4f &pose, const Eigen::Matrix4f &odometry_pose);
+  void pollCorrection();
+  void resetOdometry();
+  void log(LogLevel level, const char *format, ...) const;
+
+  Options options_;
+  std::shared_ptr<ThreadPool> pool_;
+  std::unique_ptr<AdaptiveBudget> budget_;
+  std::unique_ptr<PosePredictor> predictor_;
+  std::unique_ptr<HealthMonitor> health_;
+  std::unique_ptr<SubmapManager> submaps_;
+  std::unique_ptr<ScanOdometry> odometry_;
+  MapTileStore::ConstPtr map_store_;
+  std::atomic<bool> has_map_{false}, initialized_{false};
+
+  // the filtered in-memory map that patches merge into, edits are serialized
+  std::mutex map_mutex_;
+  Cloud::ConstPtr map_;
+
+  // prepared on the whole filtered map or swapped in per submap window
+  std::mutex matcher_mutex_;
+  ScanMatcher::Ptr matcher_;
+
+  std::mutex gps_mutex_;
+  Eigen::Vector3f gps_ = Eigen::Vector3f::Zero();
+  ImuPreintegrator imu_buffer_;
+
+  // scans and pyramid levels are recycled instead of allocated per frame
+  ScanBufferPool scan_pool_{16};
+  // one decoder per calling thread, see preprocess(), align() and startCorrection()
+  ScanDecoder scan_decoder_, level_decoder_, correction_decoder_;
+
+  // align() thread only
+  Eigen::Matrix4f init_guess_ = Eigen::Matrix4f::Identity();
+  Eigen::Matrix4f last_good_pose_ = Eigen::Matrix4f::Identity();
+  // search running on the pool, scans meanwhile take the prediction; its matcher is owned
+  // here for the same reason as correction_matcher_ below
+  std::future<InitialPoseSearch::Result> relocalization_;
+  ScanMatcher::Ptr relocalization_matcher_;
+  double relocalization_stamp_ = 0;
+  // odometry frame in the map frame, and the map match of one scan running on the pool
+  // with that scan's odometry pose. The core owns the matcher of the task: the last
+  // reference to its pool must not be dropped on a pool thread
+  Eigen::Matrix4f odometry_to_map_ = Eigen::Matrix4f::Identity();
+  std::future<Result> correction_;
+  ScanMatcher::Ptr correction_matcher_;
+  Eigen::Matrix4f correction_odometry_pose_ = Eigen::Matrix4f::Identity();
+  double correction_stamp_ = -1;
+};
+
+/* Result csv row "id,x,y,z,yaw,pitch,roll" for a base_link pose, z is written as 0 */
+std::string resultRow(int id, const Eigen::Affine3d &base_pose);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef LOCALIZATION_LOCALIZER_ROS_H
+#define LOCALIZATION_LOCALIZER_ROS_H
+
+#include <Eigen/Geometry>
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include "localization/localizer_core.h"
+#include "localization/scan_decoder.h"
+
+/*
+ * ROS side of LocalizerCore shared by the localizer node and the benchmark, so both read
+ * the same config yaml parameters the same way.
+ */
+
+/* Reads the registration, preprocessing and motion parameters; messages go to rosconsole */
+LocalizerCore::Options loadLocalizerOptions(const ros::NodeHandle &nh);
+
+/* baselink2lidar_trans / baselink2lidar_rot as the lidar pose in base_link, false if unset */
+bool loadBaseToLidar(const ros::NodeHandle &nh, Eigen::Affine3d &base_to_lidar);
+
+/* Describes the message buffer for ScanDecoder, false if its layout is not supported */
+bool rawCloudView(const sensor_msgs::PointCloud2 &msg, RawCloudView &view);
+
+/*
+ * `out` = `in` with x, y and z transformed by the vectorized kernel; false, leaving `out`
+ * untouched, for layouts rawCloudView() rejects or clouds with normals. A `stride` above
+ * 1 keeps every stride-th point of each row, in a single unorganized row.
+ */
+bool transformCloud(const Eigen::Matrix4f &T, const sensor_msgs::PointCloud2 &in, sensor_msgs::PointCloud2 &out,
+                    size_t stride = 1);
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef LOCALIZATION_MAP_PUBLISHER_H
+#define LOCALIZATION_MAP_PUBLISHER_H
+
+#include<cmath>
+#include<memory>
+#include<string>
+#include<pcl/io/pcd_io.h>
+#include<ros/ros.h>
+#include<sensor_msgs/PointCloud2.h>
+#include<geometry_msgs/PoseStamped.h>
+#include<pcl_conversions/pcl_conversions.h>
+
+#include "localization/map_tile_store.h"
+
+// The map is published once on a latched topic. header.stamp is the map version:
+// it is set when the content is built, so subscribers can skip re-ingesting a map
+// whose stamp they have already seen. Published as a shared pointer, so subscribers in
+// the same nodelet manager get it without a copy.
+inline void publish_map(ros::Publisher &pub_map, const sensor_msgs::PointCloud2::Ptr &map_cloud)
+{
+  map_cloud->header.frame_id = "world";
+  // wall clock, sim time may still be zero this early with use_sim_time
+  map_cloud->header.stamp = ros::Time(ros::WallTime::now().toSec());
+  ROS_INFO("pub map");
+  pub_map.publish(map_cloud);
+}
+
+// Tiled maps (*.tiles, see map_tiler) are memory-mapped instead of parsed. With
+// tile_radius > 0 only the tiles around the latest /lidar_pose are published.
+class TileMapPublisher
+{
+public:
+  TileMapPublisher(ros::NodeHandle &nh, const std::string &map_path, ros::Publisher &pub_map)
+      : pub_map(pub_map)
+  {
+    nh.param<double>("tile_radius", tile_radius, 0.0);
+    ready = store.open(map_path);
+    if (!ready)
+    {
+      ROS_ERROR("cannot open map tiles %s", map_path.c_str());
+      return;
+    }
+    if (tile_radius > 0)
+      sub_pose = nh.subscribe("/lidar_pose", 1, &TileMapPublisher::pose_callback, this);
+    else
+      fill(0, 0, -1);
+  }
+
+  bool ready = false;
+
+private:
+  void pose_callback(const geometry_msgs::PoseStamped::ConstPtr &msg)
+  {
+    // refresh once the vehicle crosses into another tile
+    int ix = std::floor(msg->pose.position.x / store.tileSize());
+    int iy = std::floor(msg->pose.position.y / store.tileSize());
+    if (has_center && ix == center_ix && iy == center_iy)
+      return;
+    has_center = true;
+    center_ix = ix;
+    center_iy = iy;
+    fill(msg->pose.position.x, msg->pose.position.y, tile_radius);
+  }
+
+  void fill(double x, double y, double radius)
+  {
+    pcl::PointCloud<pcl::PointXYZI> points;
+    if (radius > 0)
+      store.loadNear(x, y, radius, points);
+    else
+      store.loadAll(points);
+    sensor_msgs::PointCloud2::Ptr map_cloud(new sensor_msgs::PointCloud2);
+    pcl::toROSMsg(points, *map_cloud);
+    ROS_INFO("map tiles loaded: %zu points", points.size());
+    publish_map(pub_map, map_cloud);
+  }
+
+  MapTileStore store;
+  ros::Publisher &pub_map;
+  ros::Subscriber sub_pose;
+  double tile_radius = 0;
+  bool has_center = false;
+  int center_ix = 0, center_iy = 0;
+};
+
+// Publishes map_path (pcd or tiles) on the latched /map, used by pub_map and MapPublisherNodelet
+class MapPublisher
+{
+public:
+  explicit MapPublisher(ros::NodeHandle nh)
+  {
+    std::string map_path;
+    nh.param<std::string>("map_path", map_path, "/root/catkin_ws/src/data/itri_map.pcd");
+
+    // latched: late subscribers still get the map, without periodic re-sends
+    pub_map = nh.advertise<sensor_msgs::PointCloud2>("/map", 1, true);
+
+    if (MapTileStore::isTilePath(map_path)){
+      tiles.reset(new TileMapPublisher(nh, map_path, pub_map));
+      ready = tiles->ready;
+    }
+    else{
+      sensor_msgs::PointCloud2::Ptr map_cloud(new sensor_msgs::PointCloud2);
+      {
+        pcl::PointCloud<pcl::PointXYZI> map_points;
+        ready = pcl::io::loadPCDFile<pcl::PointXYZI>(map_path, map_points) == 0;
+        if (!ready)
+        {
+          ROS_ERROR("cannot load map %s", map_path.c_str());
+          return;
+        }
+        pcl::toROSMsg(map_points, *map_cloud);
+      }
+      publish_map(pub_map, map_cloud);
+    }
+  }
+
+  bool ready = false;
+
+private:
+  ros::Publisher pub_map;
+  std::unique_ptr<TileMapPublisher> tiles;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef LOCALIZATION_MAP_TILE_STORE_H
+#define LOCALIZATION_MAP_TILE_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+/*
+ * Read-only, memory-mapped store of a map split into square XY tiles.
+ *
+ * File layout (little endian):
+ *   TileFileHeader
+ *   TileIndexEntry[tile_count]            sorted by (ix, iy)
+ *   tile blocks of TilePoint[count]       each block starts on a page boundary
+ *
+ * Only the pages of tiles that are actually read get faulted in, so a process
+ * keeps the tiles around the vehicle resident instead of the whole map.
+ */
+class MapTileStore
+{
+public:
+  typedef std::shared_ptr<const MapTileStore> ConstPtr;
+  typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+  struct TileFileHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t tile_count;
+    float tile_size;
+    float leaf_size;
+    uint64_t point_count;
+  };
+
+  struct TileIndexEntry
+  {
+    int32_t ix, iy;
+    uint64_t offset;
+    uint32_t count;
+    uint32_t reserved;
+  };
+
+  struct TilePoint
+  {
+    float x, y, z, intensity;
+  };
+
+  MapTileStore() = default;
+  ~MapTileStore();
+  MapTileStore(const MapTileStore &) = delete;
+  MapTileStore &operator=(const MapTileStore &) = delete;
+
+  /* Map the file and read its index, returns false on a missing or malformed file */
+  bool open(const std::string &path);
+  void close();
+  bool isOpen() const { return data_ != nullptr; }
+
+  /* Append the points of every tile intersecting the XY disc, returns the number appended */
+  size_t loadNear(float x, float y, float radius, Cloud &out) const;
+
+  /* Append all tiles */
+  size_t loadAll(Cloud &out) const;
+
+  float tileSize() const { return header_.tile_size; }
+  float leafSize() const { return header_.leaf_size; }
+  uint64_t pointCount() const { return header_.point_count; }
+  size_t tileCount() const { return index_.size(); }
+
+  /* Split `cloud` into tiles of `tile_size` meters and write it to `path` */
+  static bool write(const std::string &path, const Cloud &cloud, float tile_size, float leaf_size);
+
+  static bool isTilePath(const std::string &path);
+
+private:
+  static uint64_t key(int32_t ix, int32_t iy)
+  {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(ix)) << 32) | static_cast<uint32_t>(iy);
+  }
+  size_t appendTile(const TileIndexEntry &entry, Cloud &out) const;
+
+  int fd_ = -1;
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  TileFileHeader header_{};
+  std::unordered_map<uint64_t, TileIndexEntry> index_;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef LOCALIZATION_PARALLEL_ICP_H
+#define LOCALIZATION_PARALLEL_ICP_H
+
+#include <memory>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <pcl/search/kdtree.h>
+
+#include "localization/point_kernels.h"
+#include "localization/scan_matcher.h"
+#include "localization/thread_pool.h"
+#include "localization/voxel_hash_map.h"
+
+/*
+ * Point-to-point ICP solved by Gauss-Newton, with the nearest neighbour search and the
+ * normal equation accumulation split across a thread pool.
+ *
+ * The source is cut into fixed-size chunks independent of the thread count. Each chunk
+ * accumulates its own normal equation sums in double precision, and the partial sums are
+ * reduced in chunk order, so results are bit-identical from run to run and across
+ * thread counts (on one kernel set, see point_kernels.h).
+ *
+ * Correspondences of the last iteration are kept, and fitness() evaluates them at the
+ * final pose instead of searching the tree again when they cover its range.
+ *
+ * With a positive `voxel_resolution` (icp_ivox) the target is a VoxelHashMap instead of a
+ * kd-tree, which updateTarget() edits in place, so sliding the target window or merging
+ * map patches does not rebuild the index.
+ */
+class ParallelIcpMatcher : public ScanMatcher
+{
+public:
+  typedef pcl::search::KdTree<pcl::PointXYZI> Tree;
+
+  explicit ParallelIcpMatcher(const std::shared_ptr<ThreadPool> &pool, float voxel_resolution = 0,
+                              int voxel_capacity = 20);
+
+  void setTarget(const Cloud::ConstPtr &target) override;
+  Ptr clone() const override;
+  bool supportsUpdates() const override { return voxel_resolution_ > 0; }
+  bool updateTarget(const TargetUpdate &update) override;
+
+  void align(const Cloud::ConstPtr &source, const Eigen::Matrix4f &guess, const Settings &settings) override;
+  bool hasConverged() const override { return converged_; }
+  Eigen::Matrix4f finalTransformation() const override { return final_.cast<float>(); }
+  int iterations() const override { return iterations_; }
+  double fitness(double max_range) override;
+
+private:
+  typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+  typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+  /* Per-chunk buffers, reused from iteration to iteration */
+  struct Chunk
+  {
+    PointBuffer query;    // chunk points at the linearization pose
+    PointBuffer source;   // points that found a correspondence, in the scan frame
+    PointBuffer matched;  // the same points at the linearization pose
+    PointBuffer target;   // their nearest target points
+    PointToPointSums sums;
+    double inlier_sum;
+    size_t inliers;
+  };
+
+  static const size_t kChunk = 256;
+
+  /* Per-thread kd-tree search buffers */
+  struct Search
+  {
+    std::vector<int> index = std::vector<int>(1);
+    std::vector<float> d2 = std::vector<float>(1);
+  };
+
+  /* One Gauss-Newton linearization at `T`, returns the reduced normal equation sums */
+  PointToPointSums linearize(const Eigen::Matrix4d &T, float max_distance);
+  /* Closest target point within `max_distance` of `q` in whichever index the target uses */
+  bool nearest(const Eigen::Vector3f &q, float max_distance, Search &search, Eigen::Vector3f &match,
+               float &d2) const;
+  bool hasTarget() const { return tree_ || voxels_; }
+
+  std::shared_ptr<ThreadPool> pool_;
+  const float voxel_resolution_;
+  const int voxel_capacity_;
+  Tree::Ptr tree_;
+  std::shared_ptr<VoxelHashMap> voxels_;
+  Cloud::ConstPtr source_;
+  PointBuffer source_points_;
+  std::vector<Chunk> chunks_;
+  // squared correspondence distance of the last linearization, 0 when there is none
+  double matched_d2_ = 0;
+
+  Eigen::Matrix4d final_ = Eigen::Matrix4d::Identity();
+  bool converged_ = false;
+  int iterations_ = 0;
+};
+
+#endif
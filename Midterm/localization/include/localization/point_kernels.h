@@ -0,0 +1,133 @@
+#ifndef LOCALIZATION_POINT_KERNELS_H
+#define LOCALIZATION_POINT_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_cloud.h>
+
+/*
+ * Vectorized kernels for the per-point inner loops of registration. x86 builds pick the
+ * AVX2 / FMA versions at runtime when the CPU has them, aarch64 builds use NEON, and
+ * everything else the scalar versions, so no architecture flags are needed to build.
+ *
+ * Points are passed as structure-of-arrays so one vector load fetches the same
+ * coordinate of consecutive points.
+ */
+
+/* Structure-of-arrays coordinates; reusing a buffer does not reallocate once it has grown */
+struct PointBuffer
+{
+  std::vector<float> x, y, z;
+
+  size_t size() const { return x.size(); }
+  bool empty() const { return x.empty(); }
+  void resize(size_t n)
+  {
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+  }
+  void clear() { resize(0); }
+  void push_back(float px, float py, float pz)
+  {
+    x.push_back(px);
+    y.push_back(py);
+    z.push_back(pz);
+  }
+
+  template <typename PointT>
+  void assign(const pcl::PointCloud<PointT> &cloud)
+  {
+    resize(cloud.size());
+    for (size_t i = 0; i < cloud.size(); ++i)
+    {
+      x[i] = cloud.points[i].x;
+      y[i] = cloud.points[i].y;
+      z[i] = cloud.points[i].z;
+    }
+  }
+};
+
+/* out[i] = R in[i] + t for `n` points starting at `first`; `out` may alias `in` */
+void transformPoints(const Eigen::Matrix4f &T, const PointBuffer &in, size_t first, size_t n, PointBuffer &out,
+                     size_t out_first);
+void transformPoints(const Eigen::Matrix4f &T, const PointBuffer &in, PointBuffer &out);
+
+/*
+ * Rigid transform of xyz float fields stored in place in a packed buffer such as
+ * PointCloud2 data, `count` points `step` bytes apart. Other fields are untouched.
+ */
+void transformPacked(const Eigen::Matrix4f &T, uint8_t *data, size_t count, size_t step, size_t x_offset,
+                     size_t y_offset, size_t z_offset);
+
+/*
+ * Sufficient statistics of the point-to-point Gauss-Newton system over pairs of
+ * transformed source points q and their correspondences m. With r = q - m and the left
+ * perturbation J = [-[q]x, I], J^T J and J^T r only depend on these sums, so the 6x6
+ * outer products are formed once per call instead of once per point.
+ */
+struct PointToPointSums
+{
+  double count = 0;
+  double q[3] = {0, 0, 0};
+  double qq[6] = {0, 0, 0, 0, 0, 0};  // xx, xy, xz, yy, yz, zz
+  double q_cross_r[3] = {0, 0, 0};
+  double r[3] = {0, 0, 0};
+  double rr = 0;
+
+  PointToPointSums &operator+=(const PointToPointSums &other);
+
+  /* H = sum J^T J and b = sum J^T r in [rotation, translation] order */
+  void normalEquations(Eigen::Matrix<double, 6, 6> &H, Eigen::Matrix<double, 6, 1> &b) const;
+};
+
+/* Sums over `n` pairs (q[i], m[i]) */
+PointToPointSums accumulatePointToPoint(const PointBuffer &q, const PointBuffer &m, size_t n);
+
+/* Sum and count of |q[i] - m[i]|^2 over the pairs where it is at most `max_d2` */
+void accumulateInliers(const PointBuffer &q, const PointBuffer &m, size_t n, double max_d2, double &sum,
+                       size_t &count);
+
+/* se(3) increment [rotation, translation] as a homogeneous transform */
+Eigen::Matrix4d expSe3(const Eigen::Matrix<double, 6, 1> &delta);
+/* [v]x, so that skew(v) * w = v x w */
+Eigen::Matrix3d skew(const Eigen::Vector3d &v);
+
+/*
+ * Gauss-Newton update on the left perturbation [rotation, translation] shared by the
+ * backends that build their own normal equations (icp_mt, icp_ivox, loam), with the same
+ * stopping rules as pcl: a small increment or a small change in mean squared residual.
+ */
+class GaussNewtonStep
+{
+public:
+  enum Status
+  {
+    Continue,
+    Converged,
+    Failed // no finite increment, the pose is left as it was
+  };
+
+  GaussNewtonStep(double transformation_epsilon, double fitness_epsilon)
+      : transformation_epsilon_(transformation_epsilon), fitness_epsilon_(fitness_epsilon)
+  {
+  }
+
+  /* Solves H delta = -b and moves `T` by delta; `rr` over `count` residuals is the mean error */
+  Status apply(const Eigen::Matrix<double, 6, 6> &H, const Eigen::Matrix<double, 6, 1> &b, double rr, double count,
+               Eigen::Matrix4d &T);
+
+private:
+  double transformation_epsilon_, fitness_epsilon_;
+  double previous_mse_ = std::numeric_limits<double>::max();
+};
+
+/* Name of the kernel set in use, for logs */
+const char *pointKernelIsa();
+
+#endif
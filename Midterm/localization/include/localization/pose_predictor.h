@@ -0,0 +1,54 @@
+#ifndef LOCALIZATION_POSE_PREDICTOR_H
+#define LOCALIZATION_POSE_PREDICTOR_H
+
+#include <mutex>
+
+#include <Eigen/Dense>
+
+/*
+ * Extrapolates the next scan pose from the last two registered poses with a constant
+ * velocity / constant turn-rate model in the vehicle frame, so registration starts
+ * close to the solution even during fast turns.
+ *
+ * The turn comes from the pose history, optionally blended with the rotation measured
+ * by the IMU since the last pose (imu_weight, 0 ignores the IMU). Poses more than
+ * max_gap seconds apart are not extrapolated. All methods are thread safe.
+ */
+class PosePredictor
+{
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  struct Options
+  {
+    double max_gap = 1.0;
+    float imu_weight = 0.f;
+  };
+
+  PosePredictor() {}
+  explicit PosePredictor(const Options &options) : options_(options) {}
+
+  void reset();
+  /* Registered pose of the scan taken at `stamp` */
+  void update(double stamp, const Eigen::Matrix4f &pose);
+  /*
+   * Predicted pose at `stamp`, false if no pose was registered yet. `measured_rotation`
+   * is the sensor rotation since the last pose, e.g. from ImuPreintegrator.
+   */
+  bool predict(double stamp, Eigen::Matrix4f &pose, const Eigen::Matrix3f *measured_rotation = nullptr) const;
+  /* Stamp of the last registered pose, negative before the first one */
+  double lastStamp() const;
+  /* Velocity and yaw rate at the last pose in its own frame, false without a usable history */
+  bool velocity(Eigen::Vector3f &linear, float &yaw_rate) const;
+
+private:
+  bool twist(Eigen::Vector3f &linear, float &yaw_rate) const;
+
+  Options options_;
+  mutable std::mutex mutex_;
+  int history_ = 0;
+  double stamp_ = 0, previous_stamp_ = 0;
+  Eigen::Matrix4f pose_, previous_pose_;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef LOCALIZATION_SCAN_BUFFER_POOL_H
+#define LOCALIZATION_SCAN_BUFFER_POOL_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+/*
+ * Recycles point clouds across frames.
+ *
+ * acquire() returns an empty cloud that goes back to the pool when its last reference
+ * is dropped, keeping the capacity of its point vector, so steady-state frames do not
+ * allocate. The pool may be destroyed while clouds are still out.
+ */
+class ScanBufferPool
+{
+public:
+  typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+  explicit ScanBufferPool(size_t max_free = 8) : state_(std::make_shared<State>())
+  {
+    state_->max_free = max_free;
+  }
+
+  Cloud::Ptr acquire()
+  {
+    Cloud *cloud = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      if (!state_->free.empty())
+      {
+        cloud = state_->free.back();
+        state_->free.pop_back();
+      }
+    }
+    if (!cloud)
+      cloud = new Cloud;
+
+    std::shared_ptr<State> state = state_;
+    return Cloud::Ptr(cloud, [state](Cloud *c) { state->release(c); });
+  }
+
+private:
+  struct State
+  {
+    std::mutex mutex;
+    std::vector<Cloud *> free;
+    size_t max_free = 8;
+
+    void release(Cloud *c)
+    {
+      c->clear();
+      c->header = pcl::PCLHeader();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (free.size() < max_free)
+        free.push_back(c);
+      else
+        delete c;
+    }
+
+    ~State()
+    {
+      for (Cloud *c : free)
+        delete c;
+    }
+  };
+
+  std::shared_ptr<State> state_;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef LOCALIZATION_SCAN_DECODER_H
+#define LOCALIZATION_SCAN_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "localization/voxel_hash_filter.h"
+
+/*
+ * Non-owning view of a packed point buffer laid out like sensor_msgs::PointCloud2
+ * (or pcl::PCLPointCloud2): `height` rows of `width` points, `row_step` bytes apart.
+ * x, y and z must be FLOAT32; intensity may be FLOAT32, UINT8 or UINT16, or absent.
+ * The optional per-point time counts from the start of the sweep, as drivers write it, or
+ * is absolute and compared with `stamp` when it exceeds 1e6 s.
+ */
+struct RawCloudView
+{
+  enum IntensityType
+  {
+    NoIntensity,
+    Float32,
+    Uint8,
+    Uint16
+  };
+
+  const uint8_t *data = nullptr;
+  uint32_t width = 0, height = 0;
+  uint32_t point_step = 0, row_step = 0;
+  uint32_t x_offset = 0, y_offset = 0, z_offset = 0, intensity_offset = 0;
+  IntensityType intensity_type = NoIntensity;
+
+  enum TimeType
+  {
+    NoTime,
+    Seconds32,
+    Seconds64,
+    Nanoseconds32
+  };
+
+  uint32_t time_offset = 0;
+  TimeType time_type = NoTime;
+  double stamp = 0;
+
+  size_t size() const { return static_cast<size_t>(width) * height; }
+
+  /* View over the points of an existing pcl cloud */
+  static RawCloudView fromCloud(const pcl::PointCloud<pcl::PointXYZI> &cloud);
+};
+
+/*
+ * Point selection applied while decoding, in the sensor frame. A point is kept when its
+ * range lies within [min_range, max_range], it is inside at least one crop box (or there
+ * are none) and it is outside every ego box.
+ */
+struct ScanFilter
+{
+  struct Box
+  {
+    float min[3], max[3];
+
+    bool contains(float x, float y, float z) const
+    {
+      return x >= min[0] && x <= max[0] && y >= min[1] && y <= max[1] && z >= min[2] && z <= max[2];
+    }
+  };
+
+  float min_range = 0.f;
+  float max_range = 0.f; // 0 disables
+  std::vector<Box> crop_boxes, ego_boxes;
+
+  /* Boxes from a flat [xmin ymin zmin xmax ymax zmax ...] list, false if its length is not a multiple of 6 */
+  static bool parseBoxes(const std::vector<float> &flat, std::vector<Box> &boxes);
+
+  bool empty() const { return min_range <= 0.f && max_range <= 0.f && crop_boxes.empty() && ego_boxes.empty(); }
+
+  bool keep(float x, float y, float z) const
+  {
+    float range2 = x * x + y * y + z * z;
+    if (range2 < min_range * min_range || (max_range > 0.f && range2 > max_range * max_range))
+      return false;
+    bool inside = crop_boxes.empty();
+    for (size_t i = 0; !inside && i < crop_boxes.size(); ++i)
+      inside = crop_boxes[i].contains(x, y, z);
+    if (!inside)
+      return false;
+    for (const Box &box : ego_boxes)
+      if (box.contains(x, y, z))
+        return false;
+    return true;
+  }
+};
+
+/*
+ * Constant sensor twist over one sweep, used to move every point to where it would have
+ * been seen from the sensor pose at the scan stamp. Relative per-point times and, without
+ * them, the azimuth turned since the first point of the buffer place each point in the
+ * sweep; `reference` says where in it the stamp lies.
+ */
+struct SweepMotion
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  Eigen::Vector3f angular = Eigen::Vector3f::Zero(); // rad/s, sensor frame
+  Eigen::Vector3f linear = Eigen::Vector3f::Zero();  // m/s, sensor frame
+  float period = 0.1f;                               // sweep duration in seconds
+  float reference = 1.f;                             // where the stamp lies in the sweep, 0 start, 1 end
+  bool clockwise = true;                             // spin direction seen from above
+};
+
+/*
+ * Voxel downsampling straight from a raw buffer: every point is read once, binned by
+ * floor(p / leaf) and averaged, without building an intermediate PointXYZI cloud.
+ * Cropping, ego removal and deskewing happen in the same pass.
+ * A decoder keeps its voxel table between calls, so it should be owned by one thread.
+ */
+class ScanDecoder
+{
+public:
+  typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+  /*
+   * Replaces the contents of `out` with one centroid per occupied voxel of the points
+   * `filter` keeps, deskewed with `motion` when it is given.
+   */
+  void decode(const RawCloudView &view, float leaf, Cloud &out, const ScanFilter &filter = ScanFilter(),
+              const SweepMotion *motion = nullptr);
+
+private:
+  struct Voxel
+  {
+    float x, y, z, intensity;
+    uint32_t count;
+  };
+
+  std::unordered_map<VoxelKey, uint32_t, VoxelKeyHash> index_;
+  std::vector<Voxel> voxels_;
+};
+
+#endif
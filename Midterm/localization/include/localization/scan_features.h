@@ -0,0 +1,65 @@
+#ifndef LOCALIZATION_SCAN_FEATURES_H
+#define LOCALIZATION_SCAN_FEATURES_H
+
+#include <cstdint>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+/*
+ * LOAM style feature selection on one scan in the sensor frame: sharp points (edges) and
+ * flat points (planes) by their curvature along the scan ring.
+ *
+ * The ring of a point is taken from its elevation, split into `rings` equal bins between
+ * the lowest and highest point, and points are ordered by azimuth within a ring, so the
+ * extractor also works on unorganized and voxel-downsampled clouds; `rings` should be
+ * about the beam count. The curvature of a point is the norm of the summed offsets to
+ * its `window` neighbours on each side over the sum of their lengths: 0 on a straight
+ * run, about 0.7 at a right-angled corner, whatever the range and angular resolution.
+ * Windows across a gap of more than max_step times the range are skipped.
+ *
+ * Each ring is cut into `sectors` so features spread around the sensor; per sector the
+ * edges_per_sector sharpest points above edge_threshold and the planes_per_sector
+ * flattest below plane_threshold are kept, and the neighbours of a kept point are not.
+ */
+class ScanFeatureExtractor
+{
+public:
+  typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+  struct Options
+  {
+    int rings = 32;
+    int sectors = 6;
+    int window = 5;
+    int edges_per_sector = 4;
+    int planes_per_sector = 20;
+    float edge_threshold = 0.2;
+    float plane_threshold = 0.05;
+    float max_step = 0.1;
+  };
+
+  explicit ScanFeatureExtractor(const Options &options) : options_(options) {}
+
+  /* Replaces `edges` and `planes` with the features of `scan` */
+  void extract(const Cloud &scan, Cloud &edges, Cloud &planes);
+
+  const Options &options() const { return options_; }
+
+private:
+  struct Entry
+  {
+    uint32_t index;
+    int ring;
+    float azimuth, range, curvature;
+  };
+
+  Options options_;
+  // reused from scan to scan
+  std::vector<Entry> entries_;
+  std::vector<uint32_t> breaks_, candidates_;
+  std::vector<bool> taken_;
+};
+
+#endif
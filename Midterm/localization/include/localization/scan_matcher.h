@@ -0,0 +1,109 @@
+#ifndef LOCALIZATION_SCAN_MATCHER_H
+#define LOCALIZATION_SCAN_MATCHER_H
+
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "localization/scan_features.h"
+
+class ThreadPool;
+
+/*
+ * Registration backend: a map-side target prepared once, then aligned against many scans.
+ *
+ * setTarget() does all target precomputation for the backend (kd-tree, normals,
+ * covariances or NDT cells). clone() returns an independent matcher that shares that
+ * precomputed, read-only target state, so clones can align concurrently.
+ *
+ * Backends with an incremental target (supportsUpdates()) can also be edited in place
+ * by updateTarget(), which is then visible to all clones and safe to call while they align.
+ */
+class ScanMatcher
+{
+public:
+  typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+  typedef std::shared_ptr<ScanMatcher> Ptr;
+
+  struct Settings
+  {
+    float max_distance = 1.0;
+    int iterations = 1000;
+    double transformation_epsilon = 1e-9;
+    double fitness_epsilon = 1e-9;
+  };
+
+  /* In-place target edit: the removals are applied first, then `insert` is added */
+  struct TargetUpdate
+  {
+    Cloud::ConstPtr insert;
+    std::vector<Eigen::AlignedBox3f> remove;
+    // when positive, only the target within this XY distance of keep_center is kept
+    float keep_radius = 0;
+    Eigen::Vector2f keep_center = Eigen::Vector2f::Zero();
+  };
+
+  struct Options
+  {
+    // icp, icp_mt, icp_ivox, icp_plane, gicp, ndt or loam
+    std::string type = "icp";
+    // workers for icp_mt, icp_ivox and loam, a private pool is created when unset
+    std::shared_ptr<ThreadPool> pool;
+    float ndt_resolution = 1.0;
+    double ndt_step_size = 0.1;
+    int normal_neighbors = 10;
+    // icp_ivox voxel edge in meters and points kept per voxel
+    float voxel_resolution = 1.0;
+    int voxel_capacity = 20;
+    // scan feature selection of loam, which fits its map features over normal_neighbors points
+    ScanFeatureExtractor::Options features;
+  };
+
+  virtual ~ScanMatcher() {}
+
+  virtual void setTarget(const Cloud::ConstPtr &target) = 0;
+  virtual Ptr clone() const = 0;
+
+  virtual bool supportsUpdates() const { return false; }
+  /* Edits the target without rebuilding it, false when the backend cannot */
+  virtual bool updateTarget(const TargetUpdate &update) { return false; }
+
+  virtual void align(const Cloud::ConstPtr &source, const Eigen::Matrix4f &guess, const Settings &settings) = 0;
+  virtual bool hasConverged() const = 0;
+  virtual Eigen::Matrix4f finalTransformation() const = 0;
+  virtual int iterations() const = 0;
+
+  /* Mean squared distance of the last aligned source to the target, within max_range */
+  virtual double fitness(double max_range = std::numeric_limits<double>::max()) = 0;
+  /* Share of the aligned source points that counted in the last fitness() call */
+  double inlierRatio() const { return inlier_ratio_; }
+
+  /* The cloud given to setTarget(), later updateTarget() edits are not reflected */
+  Cloud::ConstPtr target() const { return target_; }
+
+protected:
+  Cloud::ConstPtr target_;
+  double inlier_ratio_ = 0;
+};
+
+typedef std::function<ScanMatcher::Ptr()> ScanMatcherFactory;
+
+/* Returns nullptr for an unknown options.type */
+ScanMatcher::Ptr createScanMatcher(const ScanMatcher::Options &options);
+
+/*
+ * Pose covariance of a registration result: `mse` (its fitness) times the inverse
+ * point-to-point Gauss-Newton Hessian over the `source` points aligned by `pose`.
+ * Row/column order is x, y, z, roll, pitch, yaw as in geometry_msgs.
+ */
+Eigen::Matrix<double, 6, 6> registrationCovariance(const ScanMatcher::Cloud &source, const Eigen::Matrix4f &pose,
+                                                   double mse);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef LOCALIZATION_SCAN_ODOMETRY_H
+#define LOCALIZATION_SCAN_ODOMETRY_H
+
+#include <deque>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "localization/scan_matcher.h"
+#include "localization/thread_pool.h"
+
+/*
+ * Scan-to-scan odometry: registers each scan against a small local target made of the
+ * last `keyframes` keyframe scans, all in the odometry frame.
+ *
+ * A scan becomes a keyframe once it is keyframe_distance or keyframe_angle away from the
+ * previous keyframe; only then is the local target rebuilt, voxelized at `leaf`, so most
+ * frames just match a few thousand points against a small kd-tree. The odometry frame
+ * drifts, LocalizerCore anchors it to the map every correction_period.
+ */
+class ScanOdometry
+{
+public:
+  typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+  struct Options
+  {
+    int keyframes = 8;
+    float keyframe_distance = 2.0;
+    float keyframe_angle = 0.2;
+    // scan stamp seconds between scan-to-map corrections of the odometry frame
+    double correction_period = 1.0;
+    // corrections run on the pool while odometry continues, blended in by correction_gain
+    bool async_correction = true;
+    float correction_gain = 0.5;
+  };
+
+  struct Match
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    Eigen::Matrix4f pose = Eigen::Matrix4f::Identity();
+    bool converged = false;
+    double fitness = 0;
+    double inlier_ratio = 0;
+    int iterations = 0;
+  };
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  ScanOdometry(const Options &options, float leaf, const ScanMatcherFactory &factory, ThreadPool *pool);
+
+  /* False until the first keyframe */
+  bool hasTarget() const { return static_cast<bool>(matcher_); }
+  size_t keyframeCount() const { return keyframes_.size(); }
+
+  /* Registers `scan` against the local target from `guess`, both in the odometry frame */
+  bool align(const Cloud::ConstPtr &scan, const Eigen::Matrix4f &guess, const ScanMatcher::Settings &settings,
+             Match &match);
+  /* Keeps `scan` at odometry frame `pose` as a keyframe if it moved far enough, true if it did */
+  bool addFrame(const Cloud &scan, const Eigen::Matrix4f &pose);
+  void reset();
+
+private:
+  void rebuild();
+
+  Options options_;
+  float leaf_;
+  ScanMatcherFactory factory_;
+  ThreadPool *pool_;
+
+  // keyframe scans transformed into the odometry frame, oldest first
+  std::deque<Cloud::ConstPtr> keyframes_;
+  Eigen::Matrix4f last_keyframe_ = Eigen::Matrix4f::Identity();
+  ScanMatcher::Ptr matcher_;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef LOCALIZATION_STAGE_STATS_H
+#define LOCALIZATION_STAGE_STATS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Fixed-size log-scale latency histogram from 1 us to about 2 min, 8 buckets per
+ * octave, so percentiles are within 9% of the true value. add() is a few
+ * instructions and never allocates.
+ */
+class LatencyHistogram
+{
+public:
+  void add(double seconds);
+  void merge(const LatencyHistogram &other);
+  void reset() { *this = LatencyHistogram(); }
+
+  uint64_t count() const { return count_; }
+  double mean() const { return count_ ? sum_ / count_ : 0; }
+  double max() const { return max_; }
+  /* Upper bound of the bucket holding quantile `q` in [0, 1], at most max() */
+  double percentile(double q) const;
+
+private:
+  static const int kBucketsPerOctave = 8;
+  static const int kBuckets = 27 * kBucketsPerOctave;
+
+  std::array<uint32_t, kBuckets> buckets_{};
+  uint64_t count_ = 0;
+  double sum_ = 0, max_ = 0;
+};
+
+/*
+ * One histogram per named pipeline stage. Stages are timed from their own threads and
+ * read periodically by a reporter, which takes the histograms of the last window.
+ */
+class StageStats
+{
+public:
+  explicit StageStats(const std::vector<std::string> &names) : names_(names), window_(names.size()) {}
+
+  void add(size_t stage, double seconds)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    window_[stage].add(seconds);
+  }
+
+  /* Histograms since the previous call, in the order of names() */
+  std::vector<LatencyHistogram> takeWindow()
+  {
+    std::vector<LatencyHistogram> window(names_.size());
+    std::lock_guard<std::mutex> lock(mutex_);
+    window.swap(window_);
+    return window;
+  }
+
+  const std::vector<std::string> &names() const { return names_; }
+
+private:
+  const std::vector<std::string> names_;
+  std::mutex mutex_;
+  std::vector<LatencyHistogram> window_;
+};
+
+/* Adds the time until it goes out of scope to one stage */
+class ScopedStageTimer
+{
+public:
+  ScopedStageTimer(StageStats &stats, size_t stage)
+      : stats_(stats), stage_(stage), start_(std::chrono::steady_clock::now())
+  {
+  }
+  ~ScopedStageTimer()
+  {
+    stats_.add(stage_, std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count());
+  }
+
+  ScopedStageTimer(const ScopedStageTimer &) = delete;
+  ScopedStageTimer &operator=(const ScopedStageTimer &) = delete;
+
+private:
+  StageStats &stats_;
+  size_t stage_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#endif
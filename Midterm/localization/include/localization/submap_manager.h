@@ -0,0 +1,91 @@
+#ifndef LOCALIZATION_SUBMAP_MANAGER_H
+#define LOCALIZATION_SUBMAP_MANAGER_H
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "localization/map_tile_store.h"
+#include "localization/scan_matcher.h"
+
+/*
+ * Serves a local window of the map around the vehicle as the registration target.
+ *
+ * The window is a vertical cylinder of `radius` around its center. Once the vehicle
+ * moves more than `update_distance` away from the center, the next window is cropped
+ * and handed to a fresh matcher from `factory` on a background thread, so the target
+ * precomputation never runs on the matching thread, and swapped in by a later update()
+ * call. Only the very first window is built synchronously.
+ *
+ * The window is either cropped from an in-memory map (setMap) or paged in from a
+ * tile store (setStore), in which case only the tiles near the vehicle are read.
+ *
+ * Matchers with an incremental target (ScanMatcher::supportsUpdates) are not rebuilt
+ * when the window moves: the points entering the new window are inserted and the ones
+ * outside it dropped in place, still on the background thread.
+ */
+class SubmapManager
+{
+public:
+  typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+  struct Submap
+  {
+    ScanMatcher::Ptr matcher;
+    Eigen::Vector3f center;
+    uint64_t generation;
+    // points read from the source for this window, only the entering ones when it slid
+    size_t points;
+    bool slid;
+  };
+  typedef std::shared_ptr<const Submap> SubmapConstPtr;
+
+  /* Appends the map points within `radius` of `center` to `out` */
+  typedef std::function<void(const Eigen::Vector3f &center, float radius, Cloud &out)> Source;
+
+  SubmapManager(float radius, float update_distance, const ScanMatcherFactory &factory);
+  ~SubmapManager();
+
+  /* Replace the source map, the next update() builds a fresh window */
+  void setMap(const Cloud::ConstPtr &map);
+  void setStore(const MapTileStore::ConstPtr &store);
+  /*
+   * Replace the source map with `map`, which differs from the previous one by `patch`.
+   * An incremental window is edited with the part of the patch inside it and stays
+   * current (returns true), any other window is rebuilt as after setMap().
+   */
+  bool mergeMap(const Cloud::ConstPtr &map, const ScanMatcher::TargetUpdate &patch);
+
+  /* Returns true when a new window became current since the last call */
+  bool update(const Eigen::Vector3f &position);
+
+  SubmapConstPtr current() const;
+
+private:
+  void setSource(const Source &source);
+  static Source mapSource(const Cloud::ConstPtr &map);
+  SubmapConstPtr build(const Source &source, const Eigen::Vector3f &center, uint64_t generation) const;
+  /* Moves the window of `from` to `center` by editing its matcher */
+  SubmapConstPtr slide(const Source &source, const SubmapConstPtr &from, const Eigen::Vector3f &center,
+                       uint64_t generation) const;
+
+  float radius_, update_distance_;
+  ScanMatcherFactory factory_;
+
+  mutable std::mutex mutex_;
+  Source source_;
+  uint64_t generation_ = 0;
+  SubmapConstPtr current_;
+  std::future<SubmapConstPtr> pending_;
+  // a patch edit of the current matcher runs outside the lock, no new window starts meanwhile
+  bool merging_ = false;
+};
+
+#endif
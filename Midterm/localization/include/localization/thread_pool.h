@@ -0,0 +1,127 @@
+#ifndef LOCALIZATION_THREAD_POOL_H
+#define LOCALIZATION_THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Fixed set of worker threads fed from one FIFO task queue.
+ * Tasks still queued when the pool is destroyed are run before the workers exit.
+ */
+class ThreadPool
+{
+public:
+  /* threads == 0 uses one worker per hardware thread */
+  explicit ThreadPool(size_t threads = 0)
+  {
+    if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < threads; ++i)
+      workers_.emplace_back(&ThreadPool::run, this);
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto &w : workers_)
+      w.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  template <class F>
+  std::future<typename std::result_of<F()>::type> submit(F f)
+  {
+    typedef typename std::result_of<F()>::type R;
+    auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+    std::future<R> result = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.emplace([task]() { (*task)(); });
+    }
+    cv_.notify_one();
+    return result;
+  }
+
+  /*
+   * Runs f(i) for every i in [0, n) and returns once all calls finished. The caller
+   * picks up indices too, so this is safe to use from inside a pool task: it never
+   * waits on a task that has not started yet.
+   */
+  template <class F>
+  void parallelFor(size_t n, const F &f)
+  {
+    if (n == 0)
+      return;
+
+    struct State
+    {
+      std::atomic<size_t> next{0}, done{0};
+      std::mutex mutex;
+      std::condition_variable cv;
+    };
+    auto state = std::make_shared<State>();
+    // helpers that only start after all indices are taken exit without touching f
+    auto work = [state, n, &f]() {
+      for (size_t i = state->next++; i < n; i = state->next++)
+      {
+        f(i);
+        if (++state->done == n)
+        {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          state->cv.notify_all();
+        }
+      }
+    };
+
+    size_t helpers = std::min(workers_.size(), n) - 1;
+    for (size_t i = 0; i < helpers; ++i)
+      submit(work);
+    work();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cv.wait(lock, [&state, n] { return state->done == n; });
+  }
+
+  size_t size() const { return workers_.size(); }
+
+private:
+  void run()
+  {
+    for (;;)
+    {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+        if (tasks_.empty())
+          return;
+        task = std::move(tasks_.front());
+        tasks_.pop();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::queue<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+};
+
+#endif
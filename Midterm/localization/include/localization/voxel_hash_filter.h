@@ -0,0 +1,68 @@
+#ifndef LOCALIZATION_VOXEL_HASH_FILTER_H
+#define LOCALIZATION_VOXEL_HASH_FILTER_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "localization/thread_pool.h"
+
+/* Integer voxel coordinates floor(p / leaf); 32 bits per axis, so there is no practical extent limit */
+struct VoxelKey
+{
+  int32_t x, y, z;
+
+  /* false if the point is not finite or too far out for 32-bit coordinates */
+  static bool of(float px, float py, float pz, float inv_leaf, VoxelKey &key)
+  {
+    const double limit = 2147483647.0;
+    double fx = std::floor(static_cast<double>(px) * inv_leaf);
+    double fy = std::floor(static_cast<double>(py) * inv_leaf);
+    double fz = std::floor(static_cast<double>(pz) * inv_leaf);
+    if (!(std::abs(fx) < limit && std::abs(fy) < limit && std::abs(fz) < limit))
+      return false;
+    key.x = static_cast<int32_t>(fx);
+    key.y = static_cast<int32_t>(fy);
+    key.z = static_cast<int32_t>(fz);
+    return true;
+  }
+
+  bool operator==(const VoxelKey &other) const { return x == other.x && y == other.y && z == other.z; }
+};
+
+struct VoxelKeyHash
+{
+  size_t operator()(const VoxelKey &k) const
+  {
+    uint64_t h = static_cast<uint32_t>(k.x) * 0x9E3779B97F4A7C15ull;
+    h ^= static_cast<uint32_t>(k.y) * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+    h ^= static_cast<uint32_t>(k.z) * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+    return static_cast<size_t>(h ^ (h >> 29));
+  }
+};
+
+/*
+ * Voxel-grid downsampling (one centroid per occupied voxel) on a hash table instead of
+ * pcl::VoxelGrid's sorted linear indices, which overflow on large extents at small leaf
+ * sizes and then silently stop downsampling.
+ *
+ * With a pool, points are bucketed by key hash in parallel and every bucket is reduced
+ * by one worker. The output order only depends on the input, not on the thread count.
+ */
+class VoxelHashFilter
+{
+public:
+  typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+  explicit VoxelHashFilter(ThreadPool *pool = nullptr) : pool_(pool) {}
+
+  void filter(const Cloud &in, float leaf, Cloud &out) const;
+
+private:
+  ThreadPool *pool_;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef LOCALIZATION_VOXEL_HASH_MAP_H
+#define LOCALIZATION_VOXEL_HASH_MAP_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Geometry>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "localization/voxel_hash_filter.h"
+
+/*
+ * Incrementally editable nearest neighbour index: points bucketed into a hash of cubic
+ * voxels of `resolution` meters, at most `capacity` points per voxel.
+ *
+ * Unlike a kd-tree it never needs rebalancing: insert() and removeBox() only touch the
+ * voxels concerned, removeOutside() one pass over the voxel table. Emptied voxels are
+ * erased right away; the hash table itself is compacted lazily, once it has shrunk to a
+ * quarter of its bucket count.
+ *
+ * nearest() visits voxel shells in order of distance and stops as soon as no closer
+ * point can exist, so the result is the exact nearest neighbour within `max_distance`.
+ * Searches run concurrently under readLock(); edits take the lock exclusively.
+ */
+class VoxelHashMap
+{
+public:
+  typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+  typedef std::shared_ptr<VoxelHashMap> Ptr;
+  typedef std::shared_lock<std::shared_timed_mutex> ReadLock;
+
+  VoxelHashMap(float resolution, size_t capacity);
+
+  /* Adds the points, dropping those that land in full voxels; returns the number added */
+  size_t insert(const Cloud &cloud);
+  /* Removes the points inside `box`, returns the number removed */
+  size_t removeBox(const Eigen::AlignedBox3f &box);
+  /* Removes the points farther than `radius` from `center` in XY, returns the number removed */
+  size_t removeOutside(const Eigen::Vector2f &center, float radius);
+  /*
+   * One edit under a single exclusive lock, so no search sees it half done: removes the
+   * points inside each box of `remove`, then, with a positive `keep_radius`, those outside
+   * it around `keep_center`, then adds `insert` unless it is null
+   */
+  void apply(const std::vector<Eigen::AlignedBox3f> &remove, const Eigen::Vector2f &keep_center, float keep_radius,
+             const Cloud *insert);
+  void clear();
+
+  /* Hold while calling nearest(), edits wait for it */
+  ReadLock readLock() const { return ReadLock(mutex_); }
+
+  /* Closest point within `max_distance` of `query`, false if there is none; call under readLock() */
+  bool nearest(const Eigen::Vector3f &query, float max_distance, Eigen::Vector3f &point, float &d2) const;
+
+  size_t size() const;
+  /* size() for a caller already holding readLock(), the lock is not recursive */
+  size_t sizeLocked() const { return size_; }
+  size_t voxelCount() const;
+  float resolution() const { return resolution_; }
+
+private:
+  struct Voxel
+  {
+    std::vector<Eigen::Vector3f> points;
+  };
+  typedef std::unordered_map<VoxelKey, Voxel, VoxelKeyHash> Table;
+
+  /* Drops points matching `remove` from voxels selected by `candidate`, with the lock held */
+  template <typename Candidate, typename Remove>
+  size_t removeIf(const Candidate &candidate, const Remove &remove);
+  /* The edits, with the lock held */
+  size_t insertLocked(const Cloud &cloud);
+  size_t removeBoxLocked(const Eigen::AlignedBox3f &box);
+  size_t removeOutsideLocked(const Eigen::Vector2f &center, float radius);
+  void compact();
+
+  const float resolution_, inv_resolution_;
+  const size_t capacity_;
+
+  mutable std::shared_timed_mutex mutex_;
+  Table voxels_;
+  size_t size_ = 0;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#include "localization/adaptive_budget.h"
+
+#include <algorithm>
+
+AdaptiveBudget::Plan AdaptiveBudget::plan()
+{
+  Plan plan;
+  if (streak_ == 0 || pyramid_.empty())
+  {
+    plan.levels = pyramid_;
+    return plan;
+  }
+
+  if (options_.skip_streak > 0 && streak_ >= options_.skip_streak && skipped_ < options_.max_skips)
+  {
+    ++skipped_;
+    plan.skip = true;
+    return plan;
+  }
+  skipped_ = 0;
+
+  Level level = pyramid_.back();
+  ScanMatcher::Settings &settings = level.settings;
+  int iterations = static_cast<int>(options_.iteration_margin * last_iterations_);
+  settings.iterations = std::min(settings.iterations, std::max(options_.min_iterations, iterations));
+  // inliers are within a few corrections of the seed, keep a floor for map noise
+  float distance = std::max(4 * last_translation_, options_.min_distance_scale * settings.max_distance);
+  settings.max_distance = std::min(settings.max_distance, distance);
+  settings.transformation_epsilon = std::max(settings.transformation_epsilon, options_.easy_transformation_epsilon);
+  settings.fitness_epsilon = std::max(settings.fitness_epsilon, options_.easy_fitness_epsilon);
+  plan.levels.push_back(level);
+  return plan;
+}
+
+void AdaptiveBudget::report(bool converged, double fitness, float translation, float rotation, int iterations)
+{
+  bool easy = converged && fitness < options_.easy_fitness && translation < options_.easy_translation &&
+              rotation < options_.easy_rotation;
+  streak_ = easy ? streak_ + 1 : 0;
+  if (!easy)
+    skipped_ = 0;
+  last_translation_ = translation;
+  last_iterations_ = iterations;
+}
@@ -0,0 +1,81 @@
+#include "localization/async_writer.h"
+
+#include <chrono>
+
+bool AsyncWriter::open(const std::string &path)
+{
+  close();
+  if (path.empty())
+  {
+    file_ = stdout;
+    owns_file_ = false;
+  }
+  else
+  {
+    file_ = std::fopen(path.c_str(), "w");
+    owns_file_ = true;
+    if (!file_)
+      return false;
+  }
+  stop_ = false;
+  thread_ = std::thread(&AsyncWriter::run, this);
+  return true;
+}
+
+void AsyncWriter::write(std::string line)
+{
+  if (!file_)
+    return;
+  while (!queue_.push(std::move(line)))
+    std::this_thread::yield();
+  if (sleeping_)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cv_.notify_one();
+  }
+}
+
+void AsyncWriter::close()
+{
+  if (thread_.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+  }
+  if (file_)
+  {
+    std::fflush(file_);
+    if (owns_file_)
+      std::fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+void AsyncWriter::run()
+{
+  std::string line;
+  while (true)
+  {
+    bool wrote = false;
+    while (queue_.pop(line))
+    {
+      line += '\n';
+      std::fwrite(line.data(), 1, line.size(), file_);
+      wrote = true;
+    }
+    if (wrote)
+      std::fflush(file_);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stop_ && queue_.empty())
+      break;
+    // the timeout covers a write() that missed the sleeping flag
+    sleeping_ = true;
+    cv_.wait_for(lock, std::chrono::milliseconds(50), [this] { return stop_ || !queue_.empty(); });
+    sleeping_ = false;
+  }
+}
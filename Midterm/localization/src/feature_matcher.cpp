@@ -0,0 +1,293 @@
+#include "localization/feature_matcher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+// eigenvalue ratios of a neighbourhood: an edge is much longer than wide, a plane much thinner than wide
+const float kEdgeRatio = 3.f;
+const float kPlaneRatio = 0.1f;
+// and no neighbour farther from the line or plane than this share of the extent, so
+// neighbourhoods spanning two surfaces do not pull their centroid off both
+const float kTolerance = 0.1f;
+// nearest fitted features a scan feature may pair with; the one it lies closest to wins,
+// so a point low on a wall is not pulled onto the ground plane next to it
+const int kCandidates = 5;
+
+/* Features fitted by one chunk of map points */
+struct Fitted
+{
+  pcl::PointCloud<pcl::PointXYZI> edges, planes;
+  std::vector<Eigen::Vector3f> edge_directions, plane_normals;
+};
+} // namespace
+
+FeatureMatcher::FeatureMatcher(const std::shared_ptr<ThreadPool> &pool, int neighbors,
+                               const ScanFeatureExtractor::Options &features)
+    : pool_(pool), neighbors_(std::max(5, neighbors)), extractor_(features)
+{
+  if (!pool_)
+    pool_ = std::make_shared<ThreadPool>();
+}
+
+void FeatureMatcher::setTarget(const Cloud::ConstPtr &target)
+{
+  target_ = target;
+  std::shared_ptr<MapFeatures> map(new MapFeatures);
+  map->edges.reset(new Cloud);
+  map->planes.reset(new Cloud);
+  map_ = map;
+  if (!target_ || target_->empty())
+    return;
+  map->points.reset(new Tree);
+  map->points->setInputCloud(target_);
+
+  const size_t n = target_->size();
+  const size_t chunks = (n + kChunk - 1) / kChunk;
+  std::vector<Fitted> fitted(chunks);
+  const Tree &tree = *map->points;
+  pool_->parallelFor(chunks, [&](size_t c) {
+    Fitted &out = fitted[c];
+    std::vector<int> index(neighbors_);
+    std::vector<float> d2(neighbors_);
+    const size_t first = c * kChunk, last = std::min(n, first + kChunk);
+    for (size_t i = first; i < last; ++i)
+    {
+      if (tree.nearestKSearch(target_->points[i], neighbors_, index, d2) < neighbors_)
+        continue;
+      Eigen::Vector3f mean = Eigen::Vector3f::Zero();
+      for (int j : index)
+        mean += target_->points[j].getVector3fMap();
+      mean /= neighbors_;
+      Eigen::Matrix3f covariance = Eigen::Matrix3f::Zero();
+      for (int j : index)
+      {
+        Eigen::Vector3f d = target_->points[j].getVector3fMap() - mean;
+        covariance += d * d.transpose();
+      }
+      Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> solver(covariance / neighbors_);
+      const Eigen::Vector3f &eigenvalues = solver.eigenvalues();
+
+      const Eigen::Vector3f direction = solver.eigenvectors().col(2), normal = solver.eigenvectors().col(0);
+      float off_line = 0.f, off_plane = 0.f;
+      for (int j : index)
+      {
+        Eigen::Vector3f d = target_->points[j].getVector3fMap() - mean;
+        off_line = std::max(off_line, (d - d.dot(direction) * direction).norm());
+        off_plane = std::max(off_plane, std::abs(d.dot(normal)));
+      }
+
+      pcl::PointXYZI centroid = target_->points[i];
+      centroid.getVector3fMap() = mean;
+      float extent = std::sqrt(std::max(eigenvalues(2), 0.f));
+      if (eigenvalues(2) > kEdgeRatio * eigenvalues(1))
+      {
+        if (off_line > kTolerance * extent)
+          continue;
+        out.edges.push_back(centroid);
+        out.edge_directions.push_back(direction);
+      }
+      else if (eigenvalues(0) < kPlaneRatio * eigenvalues(1) && off_plane <= kTolerance * extent)
+      {
+        out.planes.push_back(centroid);
+        out.plane_normals.push_back(normal);
+      }
+    }
+  });
+
+  // chunk order, so the feature indices do not depend on scheduling
+  for (const Fitted &out : fitted)
+  {
+    map->edges->points.insert(map->edges->points.end(), out.edges.points.begin(), out.edges.points.end());
+    map->planes->points.insert(map->planes->points.end(), out.planes.points.begin(), out.planes.points.end());
+    map->edge_directions.insert(map->edge_directions.end(), out.edge_directions.begin(), out.edge_directions.end());
+    map->plane_normals.insert(map->plane_normals.end(), out.plane_normals.begin(), out.plane_normals.end());
+  }
+  for (const Cloud::Ptr &cloud : {map->edges, map->planes})
+  {
+    cloud->width = cloud->points.size();
+    cloud->height = 1;
+  }
+  if (!map->edges->empty())
+  {
+    map->edge_tree.reset(new Tree);
+    map->edge_tree->setInputCloud(map->edges);
+  }
+  if (!map->planes->empty())
+  {
+    map->plane_tree.reset(new Tree);
+    map->plane_tree->setInputCloud(map->planes);
+  }
+}
+
+ScanMatcher::Ptr FeatureMatcher::clone() const
+{
+  std::shared_ptr<FeatureMatcher> copy(new FeatureMatcher(pool_, neighbors_, extractor_.options()));
+  copy->target_ = target_;
+  copy->map_ = map_;
+  return copy;
+}
+
+void FeatureMatcher::linearize(const Eigen::Matrix4d &T, float max_distance, Chunk &total)
+{
+  const MapFeatures &map = *map_;
+  const size_t edges = edges_.size(), n = edges + planes_.size();
+  const size_t chunks = (n + kChunk - 1) / kChunk;
+  chunks_.resize(chunks);
+
+  const Eigen::Matrix3f R = T.topLeftCorner<3, 3>().cast<float>();
+  const Eigen::Vector3f t = T.topRightCorner<3, 1>().cast<float>();
+  const float max_d2 = max_distance * max_distance;
+
+  pool_->parallelFor(chunks, [&](size_t c) {
+    Chunk &chunk = chunks_[c];
+    chunk.H.setZero();
+    chunk.b.setZero();
+    chunk.rr = 0;
+    chunk.count = 0;
+    std::vector<int> index(kCandidates);
+    std::vector<float> d2(kCandidates);
+    const size_t first = c * kChunk, last = std::min(n, first + kChunk);
+    for (size_t i = first; i < last; ++i)
+    {
+      const bool edge = i < edges;
+      const pcl::PointXYZI &p = edge ? edges_.points[i] : planes_.points[i - edges];
+      const Tree::Ptr &tree = edge ? map.edge_tree : map.plane_tree;
+      pcl::PointXYZI query = p;
+      query.getVector3fMap() = R * p.getVector3fMap() + t;
+      const int found = tree ? tree->nearestKSearch(query, kCandidates, index, d2) : 0;
+      int best = -1;
+      float best_residual = std::numeric_limits<float>::max();
+      for (int k = 0; k < found && d2[k] <= max_d2; ++k)
+      {
+        const Eigen::Vector3f d = query.getVector3fMap() - (edge ? map.edges : map.planes)->points[index[k]].getVector3fMap();
+        float residual = edge ? (d - d.dot(map.edge_directions[index[k]]) * map.edge_directions[index[k]]).norm()
+                              : std::abs(d.dot(map.plane_normals[index[k]]));
+        if (residual < best_residual)
+        {
+          best = index[k];
+          best_residual = residual;
+        }
+      }
+      if (best < 0)
+        continue;
+
+      // left perturbation: q = exp(dx) q, dq/dx = [-[q]x, I], projected on the feature
+      const Eigen::Vector3d q = query.getVector3fMap().cast<double>();
+      Eigen::Matrix<double, 3, 6> J;
+      J << -skew(q), Eigen::Matrix3d::Identity();
+      if (edge)
+      {
+        const Eigen::Vector3d u = map.edge_directions[best].cast<double>();
+        const Eigen::Vector3d m = map.edges->points[best].getVector3fMap().cast<double>();
+        const Eigen::Matrix3d P = Eigen::Matrix3d::Identity() - u * u.transpose();
+        const Eigen::Vector3d r = P * (q - m);
+        const Eigen::Matrix<double, 3, 6> PJ = P * J;
+        chunk.H.noalias() += PJ.transpose() * PJ;
+        chunk.b.noalias() += PJ.transpose() * r;
+        chunk.rr += r.squaredNorm();
+      }
+      else
+      {
+        const Eigen::Vector3d normal = map.plane_normals[best].cast<double>();
+        const Eigen::Vector3d m = map.planes->points[best].getVector3fMap().cast<double>();
+        const double r = normal.dot(q - m);
+        const Vector6d nJ = J.transpose() * normal;
+        chunk.H.noalias() += nJ * nJ.transpose();
+        chunk.b.noalias() += nJ * r;
+        chunk.rr += r * r;
+      }
+      ++chunk.count;
+    }
+  });
+
+  // fixed order reduction keeps the sum independent of scheduling
+  total.H.setZero();
+  total.b.setZero();
+  total.rr = 0;
+  total.count = 0;
+  for (const Chunk &chunk : chunks_)
+  {
+    total.H += chunk.H;
+    total.b += chunk.b;
+    total.rr += chunk.rr;
+    total.count += chunk.count;
+  }
+}
+
+void FeatureMatcher::align(const Cloud::ConstPtr &source, const Eigen::Matrix4f &guess, const Settings &settings)
+{
+  source_ = source;
+  final_ = guess.cast<double>();
+  converged_ = false;
+  iterations_ = 0;
+  edges_.clear();
+  planes_.clear();
+  if (!map_ || !map_->points || !source_ || source_->empty())
+    return;
+  extractor_.extract(*source_, edges_, planes_);
+  if (edges_.size() + planes_.size() < 6)
+    return;
+
+  GaussNewtonStep step(settings.transformation_epsilon, settings.fitness_epsilon);
+  Chunk total;
+  while (iterations_ < settings.iterations)
+  {
+    linearize(final_, settings.max_distance, total);
+    ++iterations_;
+    if (total.count < 6)
+      return;
+
+    GaussNewtonStep::Status status = step.apply(total.H, total.b, total.rr, total.count, final_);
+    if (status == GaussNewtonStep::Failed)
+      return;
+    if (status == GaussNewtonStep::Converged)
+      break;
+  }
+  converged_ = true;
+}
+
+double FeatureMatcher::fitness(double max_range)
+{
+  inlier_ratio_ = 0;
+  if (!map_ || !map_->points || !source_ || source_->empty())
+    return std::numeric_limits<double>::max();
+
+  const size_t n = source_->size();
+  const size_t chunks = (n + kChunk - 1) / kChunk;
+  chunks_.resize(chunks);
+  const Eigen::Matrix3f R = final_.topLeftCorner<3, 3>().cast<float>();
+  const Eigen::Vector3f t = final_.topRightCorner<3, 1>().cast<float>();
+  const Tree &tree = *map_->points;
+
+  // max_range bounds the squared distance, as in Registration::getFitnessScore()
+  pool_->parallelFor(chunks, [&](size_t c) {
+    Chunk &chunk = chunks_[c];
+    chunk.inlier_sum = 0;
+    chunk.inliers = 0;
+    std::vector<int> index(1);
+    std::vector<float> d2(1);
+    const size_t first = c * kChunk, last = std::min(n, first + kChunk);
+    for (size_t i = first; i < last; ++i)
+    {
+      pcl::PointXYZI query = source_->points[i];
+      query.getVector3fMap() = R * query.getVector3fMap() + t;
+      if (tree.nearestKSearch(query, 1, index, d2) < 1 || d2[0] > max_range)
+        continue;
+      chunk.inlier_sum += d2[0];
+      ++chunk.inliers;
+    }
+  });
+
+  double error = 0;
+  size_t count = 0;
+  for (const Chunk &chunk : chunks_)
+  {
+    error += chunk.inlier_sum;
+    count += chunk.inliers;
+  }
+  inlier_ratio_ = static_cast<double>(count) / n;
+  return count > 0 ? error / count : std::numeric_limits<double>::max();
+}
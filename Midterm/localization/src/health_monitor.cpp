@@ -0,0 +1,30 @@
+#include "localization/health_monitor.h"
+
+#include <cstdio>
+
+bool HealthMonitor::check(bool converged, double fitness, double inlier_ratio, const Eigen::Matrix4f &predicted,
+                          const Eigen::Matrix4f &result, std::string &reason)
+{
+  Eigen::Matrix4f jump = predicted.inverse() * result;
+  float translation = jump.block<3, 1>(0, 3).norm();
+  float rotation = Eigen::AngleAxisf(Eigen::Matrix3f(jump.topLeftCorner<3, 3>())).angle();
+
+  char buffer[96] = "";
+  if (!converged)
+    std::snprintf(buffer, sizeof(buffer), "not converged");
+  else if (fitness > options_.max_fitness)
+    std::snprintf(buffer, sizeof(buffer), "fitness %.3f", fitness);
+  else if (inlier_ratio < options_.min_inlier_ratio)
+    std::snprintf(buffer, sizeof(buffer), "inlier ratio %.2f", inlier_ratio);
+  else if (!fresh_ && (translation > options_.max_jump || rotation > options_.max_jump_rotation))
+    std::snprintf(buffer, sizeof(buffer), "jump of %.2f m, %.3f rad from the prediction", translation, rotation);
+  else
+  {
+    failures_ = 0;
+    fresh_ = false;
+    return true;
+  }
+  reason = buffer;
+  ++failures_;
+  return false;
+}
@@ -0,0 +1,89 @@
+#include "localization/imu_preintegrator.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+/* SO(3) exponential, first order for tiny angles instead of dividing by zero */
+Eigen::Matrix3f exp_so3(const Eigen::Vector3f &w)
+{
+  float theta = w.norm();
+  if (theta < 1e-6f)
+  {
+    Eigen::Matrix3f skew;
+    skew << 0, -w.z(), w.y(), w.z(), 0, -w.x(), -w.y(), w.x(), 0;
+    return Eigen::Matrix3f::Identity() + skew;
+  }
+  return Eigen::AngleAxisf(theta, w / theta).matrix();
+}
+}
+
+void ImuPreintegrator::add(double stamp, const Eigen::Vector3f &gyro, const Eigen::Vector3f &accel)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  // a stamp going backwards means the bag was restarted
+  if (!samples_.empty() && stamp < samples_.back().stamp)
+    samples_.clear();
+  samples_.push_back(Sample{stamp, gyro, accel});
+  while (samples_.size() > capacity_)
+    samples_.pop_front();
+}
+
+bool ImuPreintegrator::integrate(double from, double to, Delta &delta)
+{
+  delta = Delta();
+  if (to <= from)
+    return false;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (samples_.empty() || samples_.front().stamp > from + max_latency_ || samples_.back().stamp < to - max_latency_)
+    return false;
+
+  for (size_t i = 0; i < samples_.size(); ++i)
+  {
+    // sample i holds from its stamp until the next sample, the last one until `to`
+    double begin = std::max(from, i == 0 ? from : samples_[i].stamp);
+    double end = std::min(to, i + 1 < samples_.size() ? samples_[i + 1].stamp : to);
+    if (end <= begin)
+      continue;
+
+    const float dt = end - begin;
+    const Eigen::Vector3f accel = delta.rotation * samples_[i].accel;
+    delta.position += delta.velocity * dt + 0.5f * accel * dt * dt;
+    delta.velocity += accel * dt;
+    delta.rotation = delta.rotation * exp_so3(samples_[i].gyro * dt);
+    delta.dt += dt;
+    ++delta.samples;
+  }
+
+  // keep the sample that is active at `to`, the next interval starts there
+  while (samples_.size() > 1 && samples_[1].stamp <= to)
+    samples_.pop_front();
+  return delta.samples > 0;
+}
+
+bool ImuPreintegrator::angularVelocity(double from, double to, Eigen::Vector3f &gyro)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  gyro.setZero();
+  int count = 0;
+  for (const Sample &sample : samples_)
+  {
+    if (sample.stamp >= from - max_latency_ && sample.stamp <= to + max_latency_)
+    {
+      gyro += sample.gyro;
+      ++count;
+    }
+  }
+  if (count == 0)
+    return false;
+  gyro /= count;
+  return true;
+}
+
+void ImuPreintegrator::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  samples_.clear();
+}
@@ -0,0 +1,145 @@
+#include "localization/initial_pose_search.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+#include "localization/voxel_hash_filter.h"
+
+namespace
+{
+struct Hypothesis
+{
+  Eigen::Matrix4f guess;
+  Eigen::Matrix4f pose;
+  double fitness;
+};
+typedef std::vector<Hypothesis, Eigen::aligned_allocator<Hypothesis>> Hypotheses;
+
+/* Clones of the target matcher, checked out by one hypothesis at a time */
+class MatcherPool
+{
+public:
+  MatcherPool(const ScanMatcher &matcher, size_t size)
+  {
+    for (size_t i = 0; i < size; ++i)
+      free_.push_back(matcher.clone());
+  }
+
+  ScanMatcher::Ptr acquire()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScanMatcher::Ptr m = free_.back();
+    free_.pop_back();
+    return m;
+  }
+
+  void release(const ScanMatcher::Ptr &m)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(m);
+  }
+
+private:
+  std::mutex mutex_;
+  std::vector<ScanMatcher::Ptr> free_;
+};
+
+/* Runs one registration from `guess`; fitness is max() when it diverged */
+Hypothesis align(MatcherPool &matchers, const InitialPoseSearch::Cloud::ConstPtr &scan, const Eigen::Matrix4f &guess,
+                 float max_distance, int iterations, float fitness_range)
+{
+  ScanMatcher::Settings settings;
+  settings.max_distance = max_distance;
+  settings.iterations = iterations;
+
+  ScanMatcher::Ptr matcher = matchers.acquire();
+  matcher->align(scan, guess, settings);
+  Hypothesis h{guess, matcher->finalTransformation(), std::numeric_limits<double>::max()};
+  if (matcher->hasConverged())
+    h.fitness = matcher->fitness(fitness_range);
+  matchers.release(matcher);
+  return h;
+}
+}
+
+InitialPoseSearch::Result InitialPoseSearch::search(const Cloud::ConstPtr &scan, const ScanMatcher &matcher,
+                                                    const Eigen::Vector3f &position) const
+{
+  Result result;
+  if (!scan || scan->empty() || !matcher.target() || matcher.target()->empty())
+    return result;
+
+  Cloud::Ptr coarse_scan(new Cloud);
+  VoxelHashFilter().filter(*scan, options_.coarse_leaf, *coarse_scan);
+
+  std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f>> guesses;
+  for (float yaw = 0; yaw < 2 * M_PI; yaw += options_.yaw_step)
+  {
+    for (float dx : options_.offsets)
+    {
+      for (float dy : options_.offsets)
+      {
+        Eigen::Translation3f translation(position.x() + dx, position.y() + dy, position.z());
+        Eigen::AngleAxisf rotation(yaw, Eigen::Vector3f::UnitZ());
+        guesses.push_back((translation * rotation).matrix());
+      }
+    }
+  }
+  result.hypotheses = guesses.size();
+
+  // the caller and at most size() - 1 helpers run hypotheses at a time, one clone each
+  MatcherPool matchers(matcher, std::min(pool_.size(), guesses.size()));
+
+  // coarse pass over every hypothesis, stop starting new ones after a good hit; this may
+  // run on a pool task itself, parallelFor does not wait on tasks that never start
+  std::atomic<bool> done(false);
+  const float threshold = options_.fitness_threshold;
+  Hypotheses ranked(guesses.size());
+  pool_.parallelFor(guesses.size(), [&](size_t i) {
+    if (done)
+    {
+      ranked[i] = Hypothesis{guesses[i], guesses[i], std::numeric_limits<double>::max()};
+      return;
+    }
+    ranked[i] = align(matchers, coarse_scan, guesses[i], options_.coarse_max_distance, options_.coarse_iterations,
+                      options_.fitness_range);
+    if (ranked[i].fitness < threshold)
+      done = true;
+  });
+  std::sort(ranked.begin(), ranked.end(),
+            [](const Hypothesis &a, const Hypothesis &b) { return a.fitness < b.fitness; });
+  ranked.resize(std::min<size_t>(ranked.size(), std::max(1, options_.top_k)));
+
+  // refine the best coarse poses at full resolution
+  done = false;
+  Hypotheses fine(ranked.size());
+  pool_.parallelFor(ranked.size(), [&](size_t i) {
+    const Eigen::Matrix4f &seed = ranked[i].pose;
+    if (done)
+    {
+      fine[i] = Hypothesis{seed, seed, std::numeric_limits<double>::max()};
+      return;
+    }
+    fine[i] = align(matchers, scan, seed, options_.fine_max_distance, options_.fine_iterations,
+                    options_.fitness_range);
+    if (fine[i].fitness < threshold)
+      done = true;
+  });
+
+  // if no refinement converged keep the best coarse pose
+  result.pose = ranked.front().pose;
+  double best = std::numeric_limits<double>::max();
+  for (const Hypothesis &h : fine)
+  {
+    if (h.fitness < best)
+    {
+      best = h.fitness;
+      result.pose = h.pose;
+      result.fitness = h.fitness;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,569 @@
+/*
+ * Offline benchmark: replays a bag or a directory of pcd scans through LocalizerCore as
+ * fast as possible and reports per-stage latency percentiles, iterations per frame,
+ * throughput and the pose error against a reference csv (a results csv or ground truth).
+ *
+ *   roslaunch localization bench.launch config:=nuscenes bag:=<scans.bag> map:=<map.pcd or dir>
+ *       reference:=$(rospack find localization)/results/results_2.csv
+ *
+ * The localizer parameters are read from the same config yaml as the node. Only the
+ * parameter server is used, nothing is published.
+ *
+ * Batch mode: `sequences` lists parameter namespaces under the node, each with its own
+ * config, bag or pcd_dir, map, reference and result_save_path. They run concurrently on
+ * batchJobs threads, each with its own LocalizerCore and csv; a map named by several
+ * sequences is loaded (or its tiles mapped) once and shared read-only, and every
+ * report is printed whole when its sequence finishes.
+ */
+#include <dirent.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <geometry_msgs/PointStamped.h>
+#include <sensor_msgs/Imu.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include "localization/async_writer.h"
+#include "localization/localizer_core.h"
+#include "localization/localizer_ros.h"
+#include "localization/map_tile_store.h"
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+double seconds(const Clock::time_point &since)
+{
+  return std::chrono::duration<double>(Clock::now() - since).count();
+}
+
+/* printf onto `out`, reports are collected so concurrent sequences do not interleave */
+void appendf(std::string &out, const char *format, ...)
+{
+  char buffer[512];
+  va_list args;
+  va_start(args, format);
+  int n = std::vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (n > 0)
+    out.append(buffer, std::min(static_cast<size_t>(n), sizeof(buffer) - 1));
+}
+
+/* Every sample of one measurement, percentiles are exact */
+struct Samples
+{
+  std::vector<double> values;
+
+  void add(double value) { values.push_back(value); }
+  double mean() const
+  {
+    double sum = 0;
+    for (double v : values)
+      sum += v;
+    return values.empty() ? 0 : sum / values.size();
+  }
+  double percentile(double q) const
+  {
+    if (values.empty())
+      return 0;
+    std::vector<double> sorted = values;
+    size_t k = std::min(sorted.size() - 1, static_cast<size_t>(q * (sorted.size() - 1) + 0.5));
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+  }
+  double max() const { return values.empty() ? 0 : *std::max_element(values.begin(), values.end()); }
+};
+
+struct PlanarPose
+{
+  double x, y, yaw;
+};
+
+/* Rows of an "id,x,y,z,yaw,pitch,roll" csv by id */
+bool readReference(const std::string &path, std::map<int, PlanarPose> &poses)
+{
+  std::ifstream file(path);
+  if (!file)
+    return false;
+  std::string line;
+  std::getline(file, line); // header
+  while (std::getline(file, line))
+  {
+    std::vector<double> values;
+    std::stringstream row(line);
+    std::string cell;
+    while (std::getline(row, cell, ','))
+      values.push_back(std::atof(cell.c_str()));
+    if (values.size() >= 5)
+      poses[static_cast<int>(values[0])] = PlanarPose{values[1], values[2], values[4]};
+  }
+  return true;
+}
+
+/* Regular files in `dir` ending in `extension`, sorted by name */
+std::vector<std::string> listFiles(const std::string &dir, const std::string &extension)
+{
+  std::vector<std::string> files;
+  DIR *handle = opendir(dir.c_str());
+  if (!handle)
+    return files;
+  while (dirent *entry = readdir(handle))
+  {
+    std::string name = entry->d_name;
+    if (name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0)
+      files.push_back(dir + "/" + name);
+  }
+  closedir(handle);
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+/* A pcd file, or all pcd files of a directory merged into one map */
+bool loadMap(const std::string &path, LocalizerCore::Cloud &map)
+{
+  std::vector<std::string> files = listFiles(path, ".pcd");
+  if (files.empty())
+    files.push_back(path);
+  for (const std::string &file : files)
+  {
+    LocalizerCore::Cloud tile;
+    if (pcl::io::loadPCDFile<pcl::PointXYZI>(file, tile) != 0)
+      return false;
+    map += tile;
+  }
+  return !map.empty();
+}
+
+class Bench
+{
+public:
+  Bench(LocalizerCore &core, const ros::NodeHandle &nh) : core_(core)
+  {
+    loadBaseToLidar(nh, base_to_lidar_);
+    nh.param<int>("startupBufferSize", startup_buffer_size_, 10);
+    nh.param<int>("maxFrames", max_frames_, 0);
+    std::string result_save_path;
+    nh.param<std::string>("result_save_path", result_save_path, "");
+    if (!result_save_path.empty() && writer_.open(result_save_path))
+      writer_.write("id,x,y,z,yaw,pitch,roll");
+  }
+
+  bool done() const { return max_frames_ > 0 && frames_ >= max_frames_; }
+
+  void gps(const Eigen::Vector3f &position)
+  {
+    core_.setGps(position);
+    if (gps_ready_)
+      return;
+    // the node holds scans back until the first fix, do the same so csv ids line up
+    gps_ready_ = true;
+    for (const sensor_msgs::PointCloud2::ConstPtr &msg : startup_scans_)
+      if (!done())
+        process(msg);
+    startup_scans_.clear();
+  }
+
+  void imu(const sensor_msgs::Imu &msg)
+  {
+    const geometry_msgs::Vector3 &w = msg.angular_velocity, &a = msg.linear_acceleration;
+    core_.addImu(msg.header.stamp.toSec(), Eigen::Vector3f(w.x, w.y, w.z), Eigen::Vector3f(a.x, a.y, a.z));
+  }
+
+  /* `read_time` is what it took to get the message out of the bag or pcd file */
+  void scan(const sensor_msgs::PointCloud2::ConstPtr &msg, double read_time)
+  {
+    if (done())
+      return;
+    read_.add(read_time);
+    if (!gps_ready_)
+    {
+      startup_scans_.push_back(msg);
+      if (startup_scans_.size() > static_cast<size_t>(std::max(0, startup_buffer_size_)))
+        startup_scans_.pop_front();
+      return;
+    }
+    process(msg);
+  }
+
+  void report(double wall_time, const std::string &reference_path, std::string &out)
+  {
+    writer_.close();
+    double sensor_time = last_stamp_ - first_stamp_;
+    appendf(out, "frames %d (matched %d), %.2f s wall, %.1f frames/s", frames_, matched_, wall_time,
+                 wall_time > 0 ? frames_ / wall_time : 0.);
+    if (sensor_time > 0 && wall_time > 0)
+      appendf(out, ", %.2fx real time", sensor_time / wall_time);
+    appendf(out, "\n\n%-14s %9s %9s %9s %9s %9s   [ms]\n", "stage", "mean", "p50", "p90", "p99", "max");
+    printStage(out, "read", read_);
+    printStage(out, "preprocess", preprocess_);
+    printStage(out, "target", target_);
+    printStage(out, "registration", registration_);
+    printStage(out, "output", output_);
+    printStage(out, "total", total_);
+    appendf(out, "\niterations per matched frame: mean %.1f, p50 %.0f, p90 %.0f, max %.0f\n", iterations_.mean(),
+                 iterations_.percentile(0.5), iterations_.percentile(0.9), iterations_.max());
+
+    if (reference_path.empty())
+      return;
+    std::map<int, PlanarPose> reference;
+    if (!readReference(reference_path, reference))
+    {
+      appendf(out, "\ncannot read reference %s\n", reference_path.c_str());
+      return;
+    }
+    Samples position, yaw;
+    for (const std::pair<const int, PlanarPose> &pose : poses_)
+    {
+      std::map<int, PlanarPose>::const_iterator ref = reference.find(pose.first);
+      if (ref == reference.end())
+        continue;
+      position.add(std::hypot(pose.second.x - ref->second.x, pose.second.y - ref->second.y));
+      yaw.add(std::abs(std::remainder(pose.second.yaw - ref->second.yaw, 2 * M_PI)) * 180 / M_PI);
+    }
+    double squared = 0;
+    for (double e : position.values)
+      squared += e * e;
+    double rmse = position.values.empty() ? 0 : std::sqrt(squared / position.values.size());
+    appendf(out, "\npose error vs %s (%zu frames):\n", reference_path.c_str(), position.values.size());
+    appendf(out, "  position [m]  mean %.3f, rmse %.3f, p90 %.3f, max %.3f\n", position.mean(), rmse,
+                 position.percentile(0.9), position.max());
+    appendf(out, "  yaw [deg]     mean %.3f, p90 %.3f, max %.3f\n", yaw.mean(), yaw.percentile(0.9), yaw.max());
+  }
+
+private:
+  /* One frame through all stages, timed like the node's pipeline stages */
+  void process(const sensor_msgs::PointCloud2::ConstPtr &msg)
+  {
+    double stamp = msg->header.stamp.toSec();
+    if (frames_ == 0)
+      first_stamp_ = stamp;
+    last_stamp_ = stamp;
+    Clock::time_point start = Clock::now();
+
+    LocalizerCore::Cloud::Ptr filtered = core_.acquireScan();
+    RawCloudView view;
+    if (rawCloudView(*msg, view))
+      core_.preprocess(view, stamp, *filtered);
+    else
+    {
+      LocalizerCore::Cloud::Ptr cloud = core_.acquireScan();
+      pcl::fromROSMsg(*msg, *cloud);
+      core_.preprocess(RawCloudView::fromCloud(*cloud), stamp, *filtered);
+    }
+    preprocess_.add(seconds(start));
+
+    LocalizerCore::Result result = core_.align(filtered, stamp);
+    target_.add(result.target_time);
+    registration_.add(result.registration_time);
+    if (result.matched)
+    {
+      ++matched_;
+      iterations_.add(result.iterations);
+    }
+
+    Clock::time_point output_start = Clock::now();
+    Eigen::Affine3d lidar;
+    lidar.matrix() = result.pose.cast<double>();
+    Eigen::Affine3d base = lidar * base_to_lidar_.inverse();
+    ++frames_;
+    if (writer_.isOpen())
+      writer_.write(resultRow(frames_, base));
+    poses_[frames_] = PlanarPose{base.translation().x(), base.translation().y(),
+                                    std::atan2(base.linear()(1, 0), base.linear()(0, 0))};
+    output_.add(seconds(output_start));
+    total_.add(seconds(start));
+  }
+
+  static void printStage(std::string &out, const char *name, const Samples &samples)
+  {
+    appendf(out, "%-14s %9.2f %9.2f %9.2f %9.2f %9.2f\n", name, samples.mean() * 1e3, samples.percentile(0.5) * 1e3,
+                 samples.percentile(0.9) * 1e3, samples.percentile(0.99) * 1e3, samples.max() * 1e3);
+  }
+
+  LocalizerCore &core_;
+  Eigen::Affine3d base_to_lidar_;
+  AsyncWriter writer_;
+  int startup_buffer_size_ = 10, max_frames_ = 0;
+  bool gps_ready_ = false;
+  std::deque<sensor_msgs::PointCloud2::ConstPtr> startup_scans_;
+
+  int frames_ = 0, matched_ = 0;
+  double first_stamp_ = 0, last_stamp_ = 0;
+  Samples read_, preprocess_, target_, registration_, output_, total_, iterations_;
+  std::map<int, PlanarPose> poses_;
+};
+
+/* Scans, gps and imu in bag order */
+bool replayBag(const std::string &path, const ros::NodeHandle &nh, Bench &bench)
+{
+  std::string lidar_topic, gps_topic, imu_topic;
+  nh.param<std::string>("lidarTopic", lidar_topic, "/lidar_points");
+  nh.param<std::string>("gpsTopic", gps_topic, "/gps");
+  nh.param<std::string>("imuTopic", imu_topic, "/imu/data");
+
+  rosbag::Bag bag;
+  try
+  {
+    bag.open(path, rosbag::bagmode::Read);
+  }
+  catch (const rosbag::BagException &e)
+  {
+    ROS_ERROR("cannot open %s: %s", path.c_str(), e.what());
+    return false;
+  }
+  rosbag::View view(bag, rosbag::TopicQuery(std::vector<std::string>{lidar_topic, gps_topic, imu_topic}));
+  for (const rosbag::MessageInstance &m : view)
+  {
+    if (bench.done() || !ros::ok())
+      break;
+    if (m.getTopic() == lidar_topic)
+    {
+      Clock::time_point start = Clock::now();
+      sensor_msgs::PointCloud2::ConstPtr msg = m.instantiate<sensor_msgs::PointCloud2>();
+      if (msg)
+        bench.scan(msg, seconds(start));
+    }
+    else if (m.getTopic() == gps_topic)
+    {
+      geometry_msgs::PointStamped::ConstPtr msg = m.instantiate<geometry_msgs::PointStamped>();
+      if (msg)
+        bench.gps(Eigen::Vector3f(msg->point.x, msg->point.y, msg->point.z));
+    }
+    else if (sensor_msgs::Imu::ConstPtr msg = m.instantiate<sensor_msgs::Imu>())
+      bench.imu(*msg);
+  }
+  return true;
+}
+
+/*
+ * Scans from `dir`, in file name order. Numeric file names are stamps in seconds (or
+ * nanoseconds above 1e12), other names are spaced by scanPeriod. The gps param is the fix.
+ */
+bool replayPcd(const std::string &dir, const ros::NodeHandle &nh, Bench &bench)
+{
+  std::vector<float> gps;
+  double scan_period;
+  nh.param<std::vector<float>>("gps", gps, std::vector<float>());
+  nh.param<double>("scanPeriod", scan_period, 0.1);
+  if (gps.size() != 3)
+  {
+    ROS_ERROR("pcd_dir needs the gps param (x, y, z)");
+    return false;
+  }
+  std::vector<std::string> files = listFiles(dir, ".pcd");
+  if (files.empty())
+  {
+    ROS_ERROR("no pcd files in %s", dir.c_str());
+    return false;
+  }
+  bench.gps(Eigen::Vector3f(gps[0], gps[1], gps[2]));
+  for (size_t i = 0; i < files.size() && !bench.done() && ros::ok(); ++i)
+  {
+    Clock::time_point start = Clock::now();
+    pcl::PCLPointCloud2 cloud;
+    if (pcl::io::loadPCDFile(files[i], cloud) != 0)
+    {
+      ROS_WARN("cannot read %s, skipped", files[i].c_str());
+      continue;
+    }
+    sensor_msgs::PointCloud2::Ptr msg(new sensor_msgs::PointCloud2);
+    pcl_conversions::moveFromPCL(cloud, *msg);
+
+    std::string name = files[i].substr(files[i].rfind('/') + 1);
+    name = name.substr(0, name.size() - 4);
+    char *end = nullptr;
+    double stamp = std::strtod(name.c_str(), &end);
+    if (end == name.c_str() || *end != '\0')
+      stamp = i * scan_period;
+    else if (stamp > 1e12)
+      stamp *= 1e-9;
+    msg->header.stamp = ros::Time(stamp);
+    bench.scan(msg, seconds(start));
+  }
+  return true;
+}
+/* One replay: `nh` holds its config, input, map, reference and result_save_path */
+struct Sequence
+{
+  std::string name;
+  ros::NodeHandle nh;
+  std::string bag, pcd_dir, map_path, map_tiles_path, reference;
+
+  Sequence(const std::string &name, const ros::NodeHandle &nh) : name(name), nh(nh)
+  {
+    nh.param<std::string>("bag", bag, "");
+    nh.param<std::string>("pcd_dir", pcd_dir, "");
+    nh.param<std::string>("map_path", map_path, "");
+    nh.param<std::string>("map_tiles_path", map_tiles_path, "");
+    nh.param<std::string>("reference", reference, "");
+  }
+
+  bool valid() const
+  {
+    if (bag.empty() == pcd_dir.empty())
+    {
+      ROS_ERROR("%s: set exactly one of bag and pcd_dir", nh.getNamespace().c_str());
+      return false;
+    }
+    if (map_path.empty() && map_tiles_path.empty())
+    {
+      ROS_ERROR("%s: set map_path or map_tiles_path", nh.getNamespace().c_str());
+      return false;
+    }
+    return true;
+  }
+};
+
+/* Maps by path, loaded before the sequences start and only read while they run */
+struct SharedMaps
+{
+  std::map<std::string, MapTileStore::ConstPtr> tiles;
+  std::map<std::string, LocalizerCore::Cloud::ConstPtr> clouds;
+
+  bool load(const Sequence &sequence)
+  {
+    if (!sequence.map_tiles_path.empty())
+    {
+      if (tiles.count(sequence.map_tiles_path))
+        return true;
+      std::shared_ptr<MapTileStore> store(new MapTileStore);
+      if (!store->open(sequence.map_tiles_path))
+      {
+        ROS_ERROR("cannot open map tiles %s", sequence.map_tiles_path.c_str());
+        return false;
+      }
+      tiles[sequence.map_tiles_path] = store;
+      return true;
+    }
+    if (clouds.count(sequence.map_path))
+      return true;
+    LocalizerCore::Cloud::Ptr map(new LocalizerCore::Cloud);
+    if (!loadMap(sequence.map_path, *map))
+    {
+      ROS_ERROR("cannot load map %s", sequence.map_path.c_str());
+      return false;
+    }
+    clouds[sequence.map_path] = map;
+    return true;
+  }
+};
+
+/*
+ * Replays `sequence` on its own core into `out`. `threads` replaces an unset (0) threads
+ * param so concurrent sequences split the cores instead of each taking all of them.
+ */
+bool runSequence(const Sequence &sequence, const SharedMaps &maps, int threads, std::string &out)
+{
+  LocalizerCore::Options options = loadLocalizerOptions(sequence.nh);
+  if (options.threads == 0)
+    options.threads = threads;
+  if (!sequence.name.empty() && options.logger)
+  {
+    LocalizerCore::Logger logger = options.logger;
+    std::string prefix = "[" + sequence.name + "] ";
+    options.logger = [logger, prefix](LocalizerCore::LogLevel level, const std::string &message) {
+      logger(level, prefix + message);
+    };
+  }
+  LocalizerCore core(options);
+
+  Clock::time_point start = Clock::now();
+  if (!sequence.map_tiles_path.empty())
+  {
+    if (!core.openTiles(maps.tiles.at(sequence.map_tiles_path)))
+      return false;
+  }
+  else
+    core.setMap(*maps.clouds.at(sequence.map_path));
+  appendf(out, "map ready in %.2f s\n", seconds(start));
+
+  Bench bench(core, sequence.nh);
+  start = Clock::now();
+  if (!(sequence.bag.empty() ? replayPcd(sequence.pcd_dir, sequence.nh, bench)
+                             : replayBag(sequence.bag, sequence.nh, bench)))
+    return false;
+  bench.report(seconds(start), sequence.reference, out);
+  return true;
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  ros::init(argc, argv, "localizer_bench");
+  ros::NodeHandle nh("~");
+
+  std::vector<std::string> names;
+  nh.param<std::vector<std::string>>("sequences", names, std::vector<std::string>());
+  std::vector<Sequence> sequences;
+  if (names.empty())
+    sequences.push_back(Sequence("", nh));
+  for (const std::string &name : names)
+    sequences.push_back(Sequence(name, ros::NodeHandle(nh, name)));
+
+  Clock::time_point start = Clock::now();
+  SharedMaps maps;
+  for (const Sequence &sequence : sequences)
+    if (!sequence.valid() || !maps.load(sequence))
+      return 1;
+  if (!names.empty())
+    std::printf("%zu maps loaded in %.2f s for %zu sequences\n", maps.tiles.size() + maps.clouds.size(),
+                seconds(start), sequences.size());
+
+  int hardware = std::max(1u, std::thread::hardware_concurrency());
+  int jobs;
+  nh.param<int>("batchJobs", jobs, 0);
+  if (jobs <= 0)
+    jobs = hardware;
+  jobs = std::min(jobs, static_cast<int>(sequences.size()));
+  // split the cores, but keep a helper next to the caller so parallel stages (and the
+  // relocalization hypotheses) still run side by side when jobs reach the core count
+  int threads = jobs > 1 ? std::max(2, hardware / jobs) : 0;
+
+  // workers take the next sequence until none is left
+  start = Clock::now();
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  std::mutex print_mutex;
+  auto work = [&]() {
+    for (size_t i = next++; i < sequences.size(); i = next++)
+    {
+      std::string out;
+      if (!runSequence(sequences[i], maps, threads, out))
+        failed = true;
+      std::lock_guard<std::mutex> lock(print_mutex);
+      if (!sequences[i].name.empty())
+        std::printf("\n== %s ==\n", sequences[i].name.c_str());
+      std::fputs(out.c_str(), stdout);
+      std::fflush(stdout);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int j = 1; j < jobs; ++j)
+    workers.emplace_back(work);
+  work();
+  for (std::thread &worker : workers)
+    worker.join();
+  if (!names.empty())
+    std::printf("\n%zu sequences on %d jobs in %.2f s\n", sequences.size(), jobs, seconds(start));
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,654 @@
+#include "localization/localizer_core.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <limits>
+
+#include "localization/point_kernels.h"
+#include "localization/voxel_hash_filter.h"
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+double seconds(const Clock::time_point &since)
+{
+  return std::chrono::duration<double>(Clock::now() - since).count();
+}
+
+/* `from` moved by `gain` of the way to `to`: translation interpolated, rotation slerped */
+Eigen::Matrix4f blend(const Eigen::Matrix4f &from, const Eigen::Matrix4f &to, float gain)
+{
+  Eigen::Quaternionf a(Eigen::Matrix3f(from.topLeftCorner<3, 3>()));
+  Eigen::Quaternionf b(Eigen::Matrix3f(to.topLeftCorner<3, 3>()));
+  Eigen::Matrix4f out = Eigen::Matrix4f::Identity();
+  out.topLeftCorner<3, 3>() = a.slerp(gain, b).toRotationMatrix();
+  out.block<3, 1>(0, 3) = (1.f - gain) * from.block<3, 1>(0, 3) + gain * to.block<3, 1>(0, 3);
+  return out;
+}
+} // namespace
+
+LocalizerCore::LocalizerCore(const Options &options) : options_(options)
+{
+  if (options_.pyramid.empty())
+  {
+    AdaptiveBudget::Level level;
+    level.leaf = options_.scan_leaf;
+    options_.pyramid.push_back(level);
+  }
+  pool_ = options_.matcher.pool;
+  if (!pool_)
+  {
+    pool_.reset(new ThreadPool(options_.threads > 0 ? options_.threads : 0));
+    options_.matcher.pool = pool_;
+  }
+  if (!createScanMatcher(options_.matcher))
+  {
+    log(Error, "unknown registration '%s', using icp", options_.matcher.type.c_str());
+    options_.matcher.type = "icp";
+  }
+  if (options_.matcher.type == "icp_mt" || options_.matcher.type == "icp_ivox" || options_.matcher.type == "loam")
+    log(Info, "%s on %zu threads, %s point kernels", options_.matcher.type.c_str(), pool_->size(), pointKernelIsa());
+  if (options_.adaptive_budget)
+    budget_.reset(new AdaptiveBudget(options_.budget, options_.pyramid));
+  if (options_.predict_motion)
+    predictor_.reset(new PosePredictor(options_.predictor));
+  if (options_.health_check)
+    health_.reset(new HealthMonitor(options_.health));
+  if (options_.submap_radius > 0)
+    submaps_.reset(new SubmapManager(options_.submap_radius, options_.submap_update_distance, matcherFactory()));
+  if (options_.scan_odometry)
+    odometry_.reset(new ScanOdometry(options_.odometry, options_.scan_leaf, matcherFactory(), pool_.get()));
+}
+
+LocalizerCore::~LocalizerCore()
+{
+  // a relocalization task holds the pool and the matcher
+  if (relocalization_.valid())
+    relocalization_.wait();
+  // and so does a map correction
+  if (correction_.valid())
+    correction_.wait();
+}
+
+ScanMatcherFactory LocalizerCore::matcherFactory() const
+{
+  ScanMatcher::Options options = options_.matcher;
+  return [options]() { return createScanMatcher(options); };
+}
+
+void LocalizerCore::setMap(const Cloud &map)
+{
+  Cloud::Ptr filtered(new Cloud);
+  VoxelHashFilter(pool_.get()).filter(map, options_.map_leaf, *filtered);
+  std::lock_guard<std::mutex> map_lock(map_mutex_);
+  map_ = filtered;
+
+  if (submaps_)
+  {
+    // the target is the window around the vehicle, set in align()
+    submaps_->setMap(filtered);
+  }
+  else
+  {
+    // kd-tree, normals, covariances or NDT cells are built here and never per scan
+    ScanMatcher::Ptr prepared = createScanMatcher(options_.matcher);
+    prepared->setTarget(filtered);
+    std::lock_guard<std::mutex> lock(matcher_mutex_);
+    matcher_ = prepared;
+  }
+  has_map_ = true;
+  log(Info, "map prepared: %zu -> %zu points", map.size(), filtered->size());
+}
+
+bool LocalizerCore::mergeMap(const Cloud &patch)
+{
+  std::lock_guard<std::mutex> map_lock(map_mutex_);
+  if (!map_)
+  {
+    log(Warn, "no in-memory map to merge a patch into");
+    return false;
+  }
+  Cloud::Ptr filtered(new Cloud);
+  VoxelHashFilter(pool_.get()).filter(patch, options_.map_leaf, *filtered);
+  if (filtered->empty())
+    return false;
+
+  // the patch footprint, over all heights
+  Eigen::AlignedBox3f box;
+  for (const pcl::PointXYZI &p : filtered->points)
+    box.extend(p.getVector3fMap());
+  box.min().z() = -std::numeric_limits<float>::infinity();
+  box.max().z() = std::numeric_limits<float>::infinity();
+
+  Cloud::Ptr merged(new Cloud);
+  merged->points.reserve(map_->size() + filtered->size());
+  for (const pcl::PointXYZI &p : map_->points)
+    if (!box.contains(p.getVector3fMap()))
+      merged->points.push_back(p);
+  merged->points.insert(merged->points.end(), filtered->points.begin(), filtered->points.end());
+  merged->width = merged->points.size();
+  merged->height = 1;
+
+  ScanMatcher::TargetUpdate edit;
+  edit.insert = filtered;
+  edit.remove.push_back(box);
+  bool in_place = false;
+  if (submaps_)
+  {
+    in_place = submaps_->mergeMap(merged, edit);
+  }
+  else
+  {
+    ScanMatcher::Ptr matcher = currentMatcher();
+    in_place = matcher && matcher->updateTarget(edit);
+    if (!in_place)
+    {
+      ScanMatcher::Ptr prepared = createScanMatcher(options_.matcher);
+      prepared->setTarget(merged);
+      std::lock_guard<std::mutex> lock(matcher_mutex_);
+      matcher_ = prepared;
+    }
+  }
+  map_ = merged;
+  log(Info, "map patch merged%s: %zu points over %.1f x %.1f m", in_place ? " in place" : "", filtered->size(),
+      box.max().x() - box.min().x(), box.max().y() - box.min().y());
+  return true;
+}
+
+bool LocalizerCore::openTiles(const std::string &path)
+{
+  std::shared_ptr<MapTileStore> store(new MapTileStore);
+  if (!store->open(path))
+  {
+    log(Error, "cannot open map tiles %s", path.c_str());
+    return false;
+  }
+  log(Info, "mapped %s", path.c_str());
+  return openTiles(MapTileStore::ConstPtr(store));
+}
+
+bool LocalizerCore::openTiles(const MapTileStore::ConstPtr &store)
+{
+  if (store->leafSize() != options_.map_leaf)
+    log(Warn, "map tiles were voxelized at %f, mapLeafSize is %f", store->leafSize(), options_.map_leaf);
+
+  // the store only makes sense with a window, fall back to a default radius
+  if (!submaps_)
+  {
+    options_.submap_radius = 150.;
+    submaps_.reset(new SubmapManager(options_.submap_radius, options_.submap_update_distance, matcherFactory()));
+    log(Warn, "map tiles need a submap window, using submapRadius %f", options_.submap_radius);
+  }
+  map_store_ = store;
+  submaps_->setStore(map_store_);
+  {
+    std::lock_guard<std::mutex> map_lock(map_mutex_);
+    map_.reset();
+  }
+  has_map_ = true;
+  log(Info, "opened %zu map tiles (%lu points)", map_store_->tileCount(),
+      static_cast<unsigned long>(map_store_->pointCount()));
+  return true;
+}
+
+void LocalizerCore::setGps(const Eigen::Vector3f &position)
+{
+  std::lock_guard<std::mutex> lock(gps_mutex_);
+  gps_ = position;
+}
+
+Eigen::Vector3f LocalizerCore::gps()
+{
+  std::lock_guard<std::mutex> lock(gps_mutex_);
+  return gps_;
+}
+
+void LocalizerCore::addImu(double stamp, const Eigen::Vector3f &gyro, const Eigen::Vector3f &accel)
+{
+  imu_buffer_.add(stamp, gyro, accel);
+}
+
+/*
+ * Sensor twist during the sweep ending at `stamp`: velocity and turn rate from the
+ * registered poses, angular rate from the IMU when it has samples for the sweep
+ */
+bool LocalizerCore::sweepMotion(double stamp, SweepMotion &motion)
+{
+  motion = options_.sweep;
+  bool known = false;
+  float yaw_rate;
+  if (predictor_ && predictor_->velocity(motion.linear, yaw_rate))
+  {
+    motion.angular = Eigen::Vector3f(0, 0, yaw_rate);
+    known = true;
+  }
+  Eigen::Vector3f gyro;
+  if (imu_buffer_.angularVelocity(stamp - motion.period, stamp, gyro))
+  {
+    motion.angular = options_.imu_to_lidar * gyro;
+    known = true;
+  }
+  return known;
+}
+
+void LocalizerCore::preprocess(RawCloudView view, double stamp, Cloud &out)
+{
+  view.stamp = stamp;
+  SweepMotion motion;
+  const SweepMotion *deskew = options_.deskew && sweepMotion(stamp, motion) ? &motion : nullptr;
+  scan_decoder_.decode(view, options_.scan_leaf, out, options_.filter, deskew);
+}
+
+/* setMap() may swap in a new map on another thread */
+ScanMatcher::Ptr LocalizerCore::currentMatcher()
+{
+  std::lock_guard<std::mutex> lock(matcher_mutex_);
+  return matcher_;
+}
+
+/* Re-center the submap window on `position` when in submap mode */
+void LocalizerCore::updateTarget(const Eigen::Vector3f &position)
+{
+  if (submaps_ && submaps_->update(position))
+  {
+    SubmapManager::SubmapConstPtr submap = submaps_->current();
+    std::lock_guard<std::mutex> lock(matcher_mutex_);
+    matcher_ = submap->matcher;
+    if (submap->slid)
+      log(Info, "submap slid: %zu points entered", submap->points);
+    else
+      log(Info, "submap switched: %zu points", submap->points);
+  }
+}
+
+/* Initial pose of the first scan around the gps fix, false while there is no target */
+bool LocalizerCore::initialize(const Cloud::Ptr &scan)
+{
+  Eigen::Vector3f position = gps();
+  updateTarget(position);
+
+  Eigen::Matrix4f min_pose(Eigen::Matrix4f::Identity());
+  if (options_.fixed_init_yaw)
+  {
+    // per-dataset yaw from the config, skips the search
+    min_pose.topLeftCorner<3, 3>() = Eigen::AngleAxisf(options_.init_yaw, Eigen::Vector3f::UnitZ()).matrix();
+    min_pose.block<3, 1>(0, 3) = position;
+  }
+  else
+  {
+    ScanMatcher::Ptr target = currentMatcher();
+    if (!target)
+    {
+      log(Warn, "no registration target yet");
+      return false;
+    }
+    InitialPoseSearch search(*pool_, options_.init_search);
+    InitialPoseSearch::Result found = search.search(scan, *target, position);
+    // no refinement converged, or not well enough to pass the health check: retry on the next scan
+    if (found.fitness < 0 || (health_ && found.fitness > health_->options().max_fitness))
+    {
+      log(Warn, "initial pose search failed, fitness %f", found.fitness);
+      return false;
+    }
+    min_pose = found.pose;
+    log(Info, "initial pose from %d hypotheses, fitness %f, yaw %f", found.hypotheses, found.fitness,
+        std::atan2(min_pose(1, 0), min_pose(0, 0)));
+  }
+
+  init_guess_ = min_pose;
+  last_good_pose_ = min_pose;
+  initialized_ = true;
+  return true;
+}
+
+/*
+ * Multi-hypothesis search for `scan` around the last good pose and, if that finds
+ * nothing, around the GPS fix. Runs as a pool task, align() picks up the result.
+ */
+void LocalizerCore::startRelocalization(const Cloud::Ptr &scan, double stamp)
+{
+  ScanMatcher::Ptr target = currentMatcher();
+  if (!target)
+    return;
+  Eigen::Vector3f last = last_good_pose_.block<3, 1>(0, 3), position = gps();
+  log(Warn, "lost, relocalizing around (%f, %f)", last.x(), last.y());
+
+  ThreadPool *workers = pool_.get();
+  InitialPoseSearch::Options options = options_.relocalization;
+  relocalization_stamp_ = stamp;
+  relocalization_matcher_ = target;
+  // the destructor waits for the task, the matcher outlives it
+  const ScanMatcher *matcher = target.get();
+  relocalization_ = pool_->submit([workers, options, scan, matcher, last, position]() {
+    InitialPoseSearch search(*workers, options);
+    InitialPoseSearch::Result best = search.search(scan, *matcher, last);
+    if ((best.fitness < 0 || best.fitness > options.fitness_threshold) && (position - last).norm() > 1.f)
+    {
+      InitialPoseSearch::Result around_gps = search.search(scan, *matcher, position);
+      if (around_gps.fitness >= 0 && (best.fitness < 0 || around_gps.fitness < best.fitness))
+        best = around_gps;
+    }
+    return best;
+  });
+}
+
+/* False while a relocalization is still running, otherwise its pose replaces `guess` if it is good */
+bool LocalizerCore::pollRelocalization(double stamp, Eigen::Matrix4f &guess)
+{
+  if (!relocalization_.valid())
+    return true;
+  if (relocalization_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    return false;
+
+  InitialPoseSearch::Result found = relocalization_.get();
+  relocalization_matcher_.reset();
+  if (found.fitness < 0 || (health_ && found.fitness > health_->options().max_fitness))
+  {
+    log(Warn, "relocalization failed, fitness %f", found.fitness);
+    return true;
+  }
+  log(Warn, "relocalized from %d hypotheses, fitness %f", found.hypotheses, found.fitness);
+  if (predictor_)
+  {
+    predictor_->reset();
+    predictor_->update(relocalization_stamp_, found.pose);
+  }
+  if (health_)
+    health_->reset();
+  if (odometry_)
+    resetOdometry();
+  last_good_pose_ = found.pose;
+  guess = found.pose;
+  if (predictor_)
+    predictor_->predict(stamp, guess);
+  return true;
+}
+
+LocalizerCore::Result LocalizerCore::align(const Cloud::Ptr &scan, double stamp, const Eigen::Matrix4f *seed)
+{
+  Result result;
+  result.pose = init_guess_;
+  if (!initialized_ && !initialize(scan))
+    return result;
+
+  // start from the given seed or the motion-model prediction when there is one, else from the last result
+  Eigen::Matrix4f guess = init_guess_;
+  bool predicted = seed != nullptr;
+  if (seed)
+    guess = *seed;
+  else if (predictor_)
+  {
+    // rotation measured by the IMU since the last registered scan, in the lidar frame
+    ImuPreintegrator::Delta delta;
+    double last_stamp = predictor_->lastStamp();
+    bool measured = last_stamp >= 0 && imu_buffer_.integrate(last_stamp, stamp, delta);
+    const Eigen::Matrix3f &imu_to_lidar = options_.imu_to_lidar;
+    Eigen::Matrix3f rotation = imu_to_lidar * delta.rotation * imu_to_lidar.transpose();
+    predicted = predictor_->predict(stamp, guess, measured ? &rotation : nullptr);
+  }
+  result.pose = guess;
+
+  if (!pollRelocalization(stamp, guess))
+  {
+    init_guess_ = guess;
+    return result;
+  }
+  if (odometry_)
+    return alignOdometry(scan, stamp, guess);
+
+  AdaptiveBudget::Plan plan;
+  if (budget_)
+    plan = budget_->plan();
+  else
+    plan.levels = options_.pyramid;
+  if (plan.skip && predicted)
+  {
+    // easy stretch: trust the prediction for this scan, the next one is matched again
+    init_guess_ = guess;
+    result.pose = guess;
+    return result;
+  }
+  if (plan.levels.empty())
+    plan.levels = options_.pyramid;
+
+  // the target is set once in setMap() or per submap window
+  Clock::time_point start = Clock::now();
+  updateTarget(guess.block<3, 1>(0, 3));
+  ScanMatcher::Ptr matcher = currentMatcher();
+  result.target_time = seconds(start);
+  if (!matcher)
+  {
+    log(Warn, "no registration target yet");
+    result.pose = init_guess_;
+    return result;
+  }
+
+  start = Clock::now();
+  const Eigen::Matrix4f prediction = guess;
+  Eigen::Matrix4f pose = registerScan(*matcher, scan, guess, plan.levels, level_decoder_, result);
+  result.registration_time = seconds(start);
+  if (budget_)
+  {
+    Eigen::Matrix4f correction = prediction.inverse() * pose;
+    float rotation = Eigen::AngleAxisf(Eigen::Matrix3f(correction.topLeftCorner<3, 3>())).angle();
+    budget_->report(result.converged, result.fitness, correction.block<3, 1>(0, 3).norm(), rotation,
+                    result.iterations);
+  }
+
+  std::string rejected;
+  if (health_ && !health_->check(result.converged, result.fitness, matcher->inlierRatio(), prediction, pose, rejected))
+  {
+    // a bad result must not become the next seed, continue from the prediction
+    log(Warn, "registration rejected: %s", rejected.c_str());
+    init_guess_ = prediction;
+    result.pose = prediction;
+    if (health_->lost() && !relocalization_.valid())
+      startRelocalization(scan, stamp);
+    return result;
+  }
+  last_good_pose_ = pose;
+
+  // the result is the next initial guess
+  init_guess_ = pose;
+  if (predictor_)
+    predictor_->update(stamp, pose);
+  result.pose = pose;
+  result.matched = true;
+  return result;
+}
+
+/*
+ * Coarse to fine registration, each level starts from the previous level's result.
+ * Fills in converged, iterations, levels and fitness of `result`; coarser levels are
+ * voxelized with `decoder`, which belongs to the calling thread.
+ */
+Eigen::Matrix4f LocalizerCore::registerScan(ScanMatcher &matcher, const Cloud::Ptr &scan, Eigen::Matrix4f guess,
+                                            const std::vector<AdaptiveBudget::Level> &levels, ScanDecoder &decoder,
+                                            Result &result)
+{
+  for (const AdaptiveBudget::Level &level : levels)
+  {
+    Cloud::Ptr level_scan = scan;
+    if (level.leaf > options_.scan_leaf)
+    {
+      level_scan = scan_pool_.acquire();
+      decoder.decode(RawCloudView::fromCloud(*scan), level.leaf, *level_scan);
+    }
+
+    matcher.align(level_scan, guess, level.settings);
+    guess = matcher.finalTransformation();
+  }
+
+  result.converged = matcher.hasConverged();
+  result.iterations = matcher.iterations();
+  result.levels = levels.size();
+  // fitness within the finest correspondence distance, also feeds the budget and the ekf covariance
+  result.fitness = matcher.fitness(options_.pyramid.back().settings.max_distance);
+  return matcher.finalTransformation();
+}
+
+/*
+ * Odometry mode: every scan is matched against the recent keyframes, in the odometry
+ * frame, and placed in the map through odometry_to_map_. Every correction_period one
+ * scan is also matched against the map, which re-anchors odometry_to_map_.
+ */
+LocalizerCore::Result LocalizerCore::alignOdometry(const Cloud::Ptr &scan, double stamp, const Eigen::Matrix4f &guess)
+{
+  Result result;
+  result.pose = guess;
+  const ScanOdometry::Options &odometry = options_.odometry;
+
+  Clock::time_point start = Clock::now();
+  updateTarget(guess.block<3, 1>(0, 3));
+  ScanMatcher::Ptr matcher = currentMatcher();
+  result.target_time = seconds(start);
+  if (!matcher)
+  {
+    log(Warn, "no registration target yet");
+    result.pose = init_guess_;
+    return result;
+  }
+  pollCorrection();
+
+  start = Clock::now();
+  const Eigen::Matrix4f prediction = guess;
+  Eigen::Matrix4f pose = guess, odometry_pose;
+  double inlier_ratio = 0;
+  bool anchored = odometry_->hasTarget();
+  if (anchored)
+  {
+    ScanOdometry::Match match;
+    odometry_->align(scan, odometry_to_map_.inverse() * guess, options_.pyramid.back().settings, match);
+    odometry_pose = match.pose;
+    pose = odometry_to_map_ * odometry_pose;
+    result.converged = match.converged;
+    result.iterations = match.iterations;
+    result.levels = 1;
+    result.fitness = match.fitness;
+    inlier_ratio = match.inlier_ratio;
+  }
+
+  // the first scan after a reset and synchronous corrections go to the map right here
+  bool due = correction_stamp_ < 0 || stamp - correction_stamp_ >= odometry.correction_period;
+  bool to_map = !anchored || (due && !odometry.async_correction);
+  if (to_map)
+  {
+    pose = registerScan(*matcher, scan, pose, options_.pyramid, level_decoder_, result);
+    inlier_ratio = matcher->inlierRatio();
+    correction_stamp_ = stamp;
+  }
+  result.registration_time = seconds(start);
+
+  std::string rejected;
+  if (health_ && !health_->check(result.converged, result.fitness, inlier_ratio, prediction, pose, rejected))
+  {
+    log(Warn, "%s rejected: %s", to_map ? "registration" : "odometry", rejected.c_str());
+    init_guess_ = prediction;
+    result.pose = prediction;
+    if (health_->lost() && !relocalization_.valid())
+    {
+      // the keyframes can not be trusted either
+      resetOdometry();
+      startRelocalization(scan, stamp);
+    }
+    return result;
+  }
+  last_good_pose_ = pose;
+  init_guess_ = pose;
+  if (predictor_)
+    predictor_->update(stamp, pose);
+  result.pose = pose;
+  result.matched = true;
+
+  if (!anchored)
+    odometry_pose = odometry_to_map_.inverse() * pose;
+  else if (to_map)
+    odometry_to_map_ = pose * odometry_pose.inverse();
+  odometry_->addFrame(*scan, odometry_pose);
+  if (!to_map && due && !correction_.valid())
+    startCorrection(matcher, scan, stamp, pose, odometry_pose);
+  return result;
+}
+
+/* Map match of `scan` from its odometry `pose` on the pool, odometry continues meanwhile */
+void LocalizerCore::startCorrection(const ScanMatcher::Ptr &matcher, const Cloud::Ptr &scan, double stamp,
+                                    const Eigen::Matrix4f &pose, const Eigen::Matrix4f &odometry_pose)
+{
+  correction_stamp_ = stamp;
+  correction_odometry_pose_ = odometry_pose;
+  correction_matcher_ = matcher;
+  // the destructor and resetOdometry() wait for the task, so it may use this
+  ScanMatcher *target = matcher.get();
+  correction_ = pool_->submit([this, target, scan, pose]() {
+    Result found;
+    found.pose = registerScan(*target, scan, pose, options_.pyramid, correction_decoder_, found);
+    found.matched = found.converged;
+    if (health_ && found.fitness > health_->options().max_fitness)
+      found.matched = false;
+    return found;
+  });
+}
+
+/* Blends a finished correction into odometry_to_map_, unless it is implausible */
+void LocalizerCore::pollCorrection()
+{
+  if (!correction_.valid() || correction_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    return;
+  Result found = correction_.get();
+  correction_matcher_.reset();
+
+  // how far the map moved the scan away from where odometry put it
+  Eigen::Matrix4f jump = (odometry_to_map_ * correction_odometry_pose_).inverse() * found.pose;
+  float translation = jump.block<3, 1>(0, 3).norm();
+  float rotation = Eigen::AngleAxisf(Eigen::Matrix3f(jump.topLeftCorner<3, 3>())).angle();
+  if (!found.matched ||
+      (health_ && (translation > health_->options().max_jump || rotation > health_->options().max_jump_rotation)))
+  {
+    log(Warn, "map correction rejected: fitness %f, %.2f m, %.3f rad", found.fitness, translation, rotation);
+    return;
+  }
+  Eigen::Matrix4f anchored = found.pose * correction_odometry_pose_.inverse();
+  odometry_to_map_ = blend(odometry_to_map_, anchored, options_.odometry.correction_gain);
+}
+
+/* Drops the keyframes and any running correction, the next scan is matched to the map */
+void LocalizerCore::resetOdometry()
+{
+  if (correction_.valid())
+    correction_.get();
+  correction_matcher_.reset();
+  odometry_->reset();
+  odometry_to_map_.setIdentity();
+  correction_stamp_ = -1;
+}
+
+void LocalizerCore::log(LogLevel level, const char *format, ...) const
+{
+  char message[512];
+  va_list args;
+  va_start(args, format);
+  std::vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  if (options_.logger)
+    options_.logger(level, message);
+  else
+    std::fprintf(stderr, "%s\n", message);
+}
+
+std::string resultRow(int id, const Eigen::Affine3d &base_pose)
+{
+  // same angles as tf::Matrix3x3::getEulerYPR
+  const Eigen::Matrix3d r = base_pose.linear();
+  double yaw = std::atan2(r(1, 0), r(0, 0));
+  double pitch = std::asin(-std::max(-1.0, std::min(1.0, r(2, 0))));
+  double roll = std::atan2(r(2, 1), r(2, 2));
+  // %g matches the default ostream formatting the csv used to be written with
+  char row[128];
+  std::snprintf(row, sizeof(row), "%d,%g,%g,%d,%g,%g,%g", id, base_pose.translation().x(),
+                base_pose.translation().y(), 0, yaw, pitch, roll);
+  return row;
+}
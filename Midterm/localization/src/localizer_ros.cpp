@@ -0,0 +1,239 @@
+#include "localization/localizer_ros.h"
+
+#include <cstring>
+#include <vector>
+
+#include "localization/point_kernels.h"
+
+LocalizerCore::Options loadLocalizerOptions(const ros::NodeHandle &nh)
+{
+  LocalizerCore::Options options;
+  nh.param<float>("scanLeafSize", options.scan_leaf, 1.0);
+  nh.param<float>("mapLeafSize", options.map_leaf, 1.0);
+
+  // registration pyramid, one entry per level from coarse to fine
+  std::vector<float> d_max_list, n_iter_list, leaf_size_list;
+  nh.param<std::vector<float>>("d_max_list", d_max_list, std::vector<float>{1.0});
+  nh.param<std::vector<float>>("n_iter_list", n_iter_list, std::vector<float>{1000});
+  nh.param<std::vector<float>>("leaf_size_list", leaf_size_list, std::vector<float>());
+  double transformationEpsilon, fitnessEpsilon;
+  nh.param<double>("transformationEpsilon", transformationEpsilon, 1e-9);
+  nh.param<double>("fitnessEpsilon", fitnessEpsilon, 1e-9);
+  if (d_max_list.empty() || d_max_list.size() != n_iter_list.size())
+  {
+    ROS_ERROR("d_max_list and n_iter_list must have the same non-zero size, using one level");
+    d_max_list.assign(1, 1.0);
+    n_iter_list.assign(1, 1000);
+  }
+  // levels without a leaf size match at scanLeafSize
+  leaf_size_list.resize(d_max_list.size(), options.scan_leaf);
+  for (size_t level = 0; level < d_max_list.size(); ++level)
+  {
+    AdaptiveBudget::Level l;
+    l.leaf = leaf_size_list[level];
+    l.settings.max_distance = d_max_list[level];
+    l.settings.iterations = static_cast<int>(n_iter_list[level]);
+    l.settings.transformation_epsilon = transformationEpsilon;
+    l.settings.fitness_epsilon = fitnessEpsilon;
+    options.pyramid.push_back(l);
+  }
+
+  nh.param<bool>("adaptiveBudget", options.adaptive_budget, false);
+  nh.param<double>("budgetEasyFitness", options.budget.easy_fitness, 0.05);
+  nh.param<float>("budgetEasyTranslation", options.budget.easy_translation, 0.1);
+  nh.param<float>("budgetEasyRotation", options.budget.easy_rotation, 0.01);
+  nh.param<int>("budgetMinIterations", options.budget.min_iterations, 10);
+  nh.param<int>("budgetSkipStreak", options.budget.skip_streak, 0);
+  nh.param<int>("budgetMaxSkips", options.budget.max_skips, 1);
+  nh.param<float>("submapRadius", options.submap_radius, 0.0);
+  nh.param<float>("submapUpdateDistance", options.submap_update_distance, 20.0);
+
+  nh.param<int>("threads", options.threads, 0);
+  nh.param<std::string>("registration", options.matcher.type, "icp");
+  nh.param<float>("ndtResolution", options.matcher.ndt_resolution, 1.0);
+  nh.param<double>("ndtStepSize", options.matcher.ndt_step_size, 0.1);
+  nh.param<int>("normalNeighbors", options.matcher.normal_neighbors, 10);
+  nh.param<float>("ivoxResolution", options.matcher.voxel_resolution, 1.0);
+  nh.param<int>("ivoxCapacity", options.matcher.voxel_capacity, 20);
+  ScanFeatureExtractor::Options &features = options.matcher.features;
+  nh.param<int>("featureRings", features.rings, 32);
+  nh.param<int>("featureSectors", features.sectors, 6);
+  nh.param<int>("featureEdgesPerSector", features.edges_per_sector, 4);
+  nh.param<int>("featurePlanesPerSector", features.planes_per_sector, 20);
+  nh.param<float>("featureEdgeThreshold", features.edge_threshold, 0.2);
+  nh.param<float>("featurePlaneThreshold", features.plane_threshold, 0.05);
+
+  options.fixed_init_yaw = nh.getParam("initYaw", options.init_yaw);
+  InitialPoseSearch::Options &init = options.init_search;
+  nh.param<float>("initYawStep", init.yaw_step, 0.2);
+  nh.param<std::vector<float>>("initOffsets", init.offsets, std::vector<float>{0.f});
+  nh.param<float>("initCoarseLeafSize", init.coarse_leaf, 1.0);
+  nh.param<float>("initCoarseMaxDistance", init.coarse_max_distance, 2.0);
+  nh.param<int>("initCoarseIterations", init.coarse_iterations, 30);
+  nh.param<int>("initTopK", init.top_k, 3);
+  nh.param<float>("initFitnessThreshold", init.fitness_threshold, 0.05);
+
+  std::vector<float> crop_boxes, ego_boxes;
+  nh.param<std::vector<float>>("cropBoxes", crop_boxes, std::vector<float>());
+  nh.param<std::vector<float>>("egoBoxes", ego_boxes, std::vector<float>());
+  nh.param<float>("minRange", options.filter.min_range, 0.0);
+  nh.param<float>("maxRange", options.filter.max_range, 0.0);
+  if (!ScanFilter::parseBoxes(crop_boxes, options.filter.crop_boxes))
+    ROS_ERROR("cropBoxes needs 6 values per box, not cropping");
+  if (!ScanFilter::parseBoxes(ego_boxes, options.filter.ego_boxes))
+    ROS_ERROR("egoBoxes needs 6 values per box, not removing the ego vehicle");
+
+  std::vector<float> imu_rot;
+  nh.param<std::vector<float>>("imu2lidar_rot", imu_rot, std::vector<float>{0, 0, 0, 1});
+  if (imu_rot.size() == 4)
+    options.imu_to_lidar =
+        Eigen::Quaternionf(imu_rot[3], imu_rot[0], imu_rot[1], imu_rot[2]).normalized().toRotationMatrix();
+  else
+    ROS_ERROR("imu2lidar_rot needs 4 values (x, y, z, w), using identity");
+  nh.param<bool>("predictMotion", options.predict_motion, true);
+  nh.param<double>("predictorMaxGap", options.predictor.max_gap, 1.0);
+  nh.param<float>("predictorImuWeight", options.predictor.imu_weight, 0.0);
+  nh.param<bool>("deskew", options.deskew, false);
+  nh.param<float>("sweepPeriod", options.sweep.period, 0.1);
+  nh.param<float>("sweepReference", options.sweep.reference, 1.0);
+  nh.param<bool>("sweepClockwise", options.sweep.clockwise, true);
+
+  nh.param<bool>("healthCheck", options.health_check, false);
+  nh.param<double>("healthMaxFitness", options.health.max_fitness, 0.5);
+  nh.param<double>("healthMinInlierRatio", options.health.min_inlier_ratio, 0.3);
+  nh.param<float>("healthMaxJump", options.health.max_jump, 2.0);
+  nh.param<float>("healthMaxJumpRotation", options.health.max_jump_rotation, 0.3);
+  nh.param<int>("healthMaxFailures", options.health.max_failures, 3);
+
+  nh.param<bool>("scanOdometry", options.scan_odometry, false);
+  nh.param<int>("odometryKeyframes", options.odometry.keyframes, 8);
+  nh.param<float>("odometryKeyframeDistance", options.odometry.keyframe_distance, 2.0);
+  nh.param<float>("odometryKeyframeAngle", options.odometry.keyframe_angle, 0.2);
+  nh.param<double>("odometryCorrectionPeriod", options.odometry.correction_period, 1.0);
+  nh.param<bool>("odometryAsyncCorrection", options.odometry.async_correction, true);
+  nh.param<float>("odometryCorrectionGain", options.odometry.correction_gain, 0.5);
+  options.relocalization = options.init_search;
+  nh.param<std::vector<float>>("relocOffsets", options.relocalization.offsets, std::vector<float>{-2.f, 0.f, 2.f});
+
+  options.logger = [](LocalizerCore::LogLevel level, const std::string &message) {
+    if (level == LocalizerCore::Error)
+      ROS_ERROR("%s", message.c_str());
+    else if (level == LocalizerCore::Warn)
+      ROS_WARN("%s", message.c_str());
+    else
+      ROS_INFO("%s", message.c_str());
+  };
+  return options;
+}
+
+bool loadBaseToLidar(const ros::NodeHandle &nh, Eigen::Affine3d &base_to_lidar)
+{
+  std::vector<float> trans, rot;
+  nh.param<std::vector<float>>("baselink2lidar_trans", trans, std::vector<float>());
+  nh.param<std::vector<float>>("baselink2lidar_rot", rot, std::vector<float>());
+  if (trans.size() != 3 || rot.size() != 4)
+  {
+    ROS_ERROR("transform not set properly");
+    base_to_lidar.setIdentity();
+    return false;
+  }
+  base_to_lidar = Eigen::Translation3d(trans[0], trans[1], trans[2]) *
+                  Eigen::Quaterniond(rot[3], rot[0], rot[1], rot[2]).normalized();
+  return true;
+}
+
+bool rawCloudView(const sensor_msgs::PointCloud2 &msg, RawCloudView &view)
+{
+  if (msg.is_bigendian || msg.point_step == 0 || msg.data.size() < static_cast<size_t>(msg.row_step) * msg.height ||
+      msg.row_step < static_cast<size_t>(msg.point_step) * msg.width)
+    return false;
+
+  int found = 0;
+  for (const sensor_msgs::PointField &field : msg.fields)
+  {
+    if (field.count != 1)
+      continue;
+    if (field.name == "x" || field.name == "y" || field.name == "z")
+    {
+      if (field.datatype != sensor_msgs::PointField::FLOAT32 || field.offset + 4 > msg.point_step)
+        return false;
+      (field.name == "x" ? view.x_offset : field.name == "y" ? view.y_offset : view.z_offset) = field.offset;
+      ++found;
+    }
+    else if (field.name == "time" || field.name == "t" || field.name == "timestamp" || field.name == "offset_time")
+    {
+      // ignored when its type is unknown, deskew then falls back to the azimuth
+      view.time_offset = field.offset;
+      if (field.datatype == sensor_msgs::PointField::FLOAT32 && field.offset + 4 <= msg.point_step)
+        view.time_type = RawCloudView::Seconds32;
+      else if (field.datatype == sensor_msgs::PointField::FLOAT64 && field.offset + 8 <= msg.point_step)
+        view.time_type = RawCloudView::Seconds64;
+      else if (field.datatype == sensor_msgs::PointField::UINT32 && field.offset + 4 <= msg.point_step)
+        view.time_type = RawCloudView::Nanoseconds32;
+    }
+    else if (field.name == "intensity")
+    {
+      view.intensity_offset = field.offset;
+      if (field.datatype == sensor_msgs::PointField::FLOAT32 && field.offset + 4 <= msg.point_step)
+        view.intensity_type = RawCloudView::Float32;
+      else if (field.datatype == sensor_msgs::PointField::UINT8 && field.offset + 1 <= msg.point_step)
+        view.intensity_type = RawCloudView::Uint8;
+      else if (field.datatype == sensor_msgs::PointField::UINT16 && field.offset + 2 <= msg.point_step)
+        view.intensity_type = RawCloudView::Uint16;
+      else
+        return false;
+    }
+  }
+  if (found != 3)
+    return false;
+
+  view.data = msg.data.data();
+  view.width = msg.width;
+  view.height = msg.height;
+  view.point_step = msg.point_step;
+  view.row_step = msg.row_step;
+  view.stamp = msg.header.stamp.toSec();
+  return true;
+}
+
+bool transformCloud(const Eigen::Matrix4f &T, const sensor_msgs::PointCloud2 &in, sensor_msgs::PointCloud2 &out,
+                    size_t stride)
+{
+  RawCloudView view;
+  if (!rawCloudView(in, view))
+    return false;
+  // pcl_ros also rotates normals, leave those clouds to it
+  for (const sensor_msgs::PointField &field : in.fields)
+    if (field.name == "normal_x")
+      return false;
+
+  if (stride <= 1)
+  {
+    out = in;
+    for (uint32_t row = 0; row < out.height; ++row)
+      transformPacked(T, out.data.data() + static_cast<size_t>(row) * out.row_step, out.width, out.point_step,
+                      view.x_offset, view.y_offset, view.z_offset);
+    return true;
+  }
+
+  // every stride-th point of each row, packed into one unorganized row
+  out.header = in.header;
+  out.fields = in.fields;
+  out.is_bigendian = in.is_bigendian;
+  out.point_step = in.point_step;
+  out.is_dense = in.is_dense;
+  out.height = 1;
+  size_t per_row = (in.width + stride - 1) / stride;
+  out.data.resize(per_row * in.height * in.point_step);
+  uint8_t *dst = out.data.data();
+  for (uint32_t row = 0; row < in.height; ++row)
+  {
+    const uint8_t *src = in.data.data() + static_cast<size_t>(row) * in.row_step;
+    for (size_t col = 0; col < in.width; col += stride, dst += in.point_step)
+      std::memcpy(dst, src + col * in.point_step, in.point_step);
+  }
+  out.width = static_cast<uint32_t>(per_row * in.height);
+  out.row_step = out.width * out.point_step;
+  transformPacked(T, out.data.data(), out.width, out.point_step, view.x_offset, view.y_offset, view.z_offset);
+  return true;
+}
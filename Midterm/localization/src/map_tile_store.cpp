@@ -0,0 +1,216 @@
+#include "localization/map_tile_store.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+const char kMagic[8] = {'L', 'O', 'C', 'T', 'I', 'L', 'E', 'S'};
+const uint32_t kVersion = 1;
+const uint64_t kPageSize = 4096;
+
+uint64_t align_up(uint64_t v)
+{
+  return (v + kPageSize - 1) / kPageSize * kPageSize;
+}
+}
+
+MapTileStore::~MapTileStore()
+{
+  close();
+}
+
+bool MapTileStore::open(const std::string &path)
+{
+  close();
+  fd_ = ::open(path.c_str(), O_RDONLY);
+  if (fd_ < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd_, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(TileFileHeader))
+  {
+    close();
+    return false;
+  }
+  size_ = st.st_size;
+
+  void *addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+  if (addr == MAP_FAILED)
+  {
+    close();
+    return false;
+  }
+  data_ = static_cast<const uint8_t *>(addr);
+  // tiles are read by location, not sequentially, so skip kernel readahead
+  madvise(addr, size_, MADV_RANDOM);
+
+  std::memcpy(&header_, data_, sizeof(header_));
+  size_t index_end = sizeof(TileFileHeader) + sizeof(TileIndexEntry) * static_cast<size_t>(header_.tile_count);
+  if (std::memcmp(header_.magic, kMagic, sizeof(kMagic)) != 0 || header_.version != kVersion ||
+      header_.tile_size <= 0 || index_end > size_)
+  {
+    close();
+    return false;
+  }
+
+  const TileIndexEntry *entries = reinterpret_cast<const TileIndexEntry *>(data_ + sizeof(TileFileHeader));
+  for (uint32_t i = 0; i < header_.tile_count; ++i)
+  {
+    const TileIndexEntry &e = entries[i];
+    if (e.offset + sizeof(TilePoint) * static_cast<uint64_t>(e.count) > size_)
+    {
+      close();
+      return false;
+    }
+    index_[key(e.ix, e.iy)] = e;
+  }
+  return true;
+}
+
+void MapTileStore::close()
+{
+  if (data_)
+    munmap(const_cast<uint8_t *>(data_), size_);
+  if (fd_ >= 0)
+    ::close(fd_);
+  data_ = nullptr;
+  fd_ = -1;
+  size_ = 0;
+  header_ = TileFileHeader();
+  index_.clear();
+}
+
+size_t MapTileStore::appendTile(const TileIndexEntry &entry, Cloud &out) const
+{
+  const TilePoint *src = reinterpret_cast<const TilePoint *>(data_ + entry.offset);
+  size_t begin = out.points.size();
+  out.points.resize(begin + entry.count);
+  for (uint32_t i = 0; i < entry.count; ++i)
+  {
+    pcl::PointXYZI &p = out.points[begin + i];
+    p.x = src[i].x;
+    p.y = src[i].y;
+    p.z = src[i].z;
+    p.intensity = src[i].intensity;
+  }
+  return entry.count;
+}
+
+size_t MapTileStore::loadNear(float x, float y, float radius, Cloud &out) const
+{
+  if (!data_)
+    return 0;
+
+  const float ts = header_.tile_size;
+  int32_t ix0 = static_cast<int32_t>(std::floor((x - radius) / ts));
+  int32_t ix1 = static_cast<int32_t>(std::floor((x + radius) / ts));
+  int32_t iy0 = static_cast<int32_t>(std::floor((y - radius) / ts));
+  int32_t iy1 = static_cast<int32_t>(std::floor((y + radius) / ts));
+
+  size_t added = 0;
+  for (int32_t ix = ix0; ix <= ix1; ++ix)
+  {
+    for (int32_t iy = iy0; iy <= iy1; ++iy)
+    {
+      // distance from the disc center to the closest point of the tile
+      float dx = std::max(std::max(ix * ts - x, x - (ix + 1) * ts), 0.f);
+      float dy = std::max(std::max(iy * ts - y, y - (iy + 1) * ts), 0.f);
+      if (dx * dx + dy * dy > radius * radius)
+        continue;
+      auto it = index_.find(key(ix, iy));
+      if (it != index_.end())
+        added += appendTile(it->second, out);
+    }
+  }
+  out.width = out.points.size();
+  out.height = 1;
+  return added;
+}
+
+size_t MapTileStore::loadAll(Cloud &out) const
+{
+  if (!data_)
+    return 0;
+
+  out.points.reserve(out.points.size() + header_.point_count);
+  const TileIndexEntry *entries = reinterpret_cast<const TileIndexEntry *>(data_ + sizeof(TileFileHeader));
+  size_t added = 0;
+  for (uint32_t i = 0; i < header_.tile_count; ++i)
+    added += appendTile(entries[i], out);
+  out.width = out.points.size();
+  out.height = 1;
+  return added;
+}
+
+bool MapTileStore::write(const std::string &path, const Cloud &cloud, float tile_size, float leaf_size)
+{
+  if (tile_size <= 0)
+    return false;
+
+  std::map<std::pair<int32_t, int32_t>, std::vector<TilePoint>> tiles;
+  for (const auto &p : cloud.points)
+  {
+    if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+      continue;
+    int32_t ix = static_cast<int32_t>(std::floor(p.x / tile_size));
+    int32_t iy = static_cast<int32_t>(std::floor(p.y / tile_size));
+    tiles[std::make_pair(ix, iy)].push_back(TilePoint{p.x, p.y, p.z, p.intensity});
+  }
+
+  TileFileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.tile_count = tiles.size();
+  header.tile_size = tile_size;
+  header.leaf_size = leaf_size;
+
+  std::vector<TileIndexEntry> index;
+  index.reserve(tiles.size());
+  uint64_t offset = align_up(sizeof(TileFileHeader) + sizeof(TileIndexEntry) * tiles.size());
+  for (const auto &tile : tiles)
+  {
+    TileIndexEntry e{};
+    e.ix = tile.first.first;
+    e.iy = tile.first.second;
+    e.offset = offset;
+    e.count = tile.second.size();
+    index.push_back(e);
+    header.point_count += e.count;
+    offset = align_up(offset + sizeof(TilePoint) * e.count);
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file)
+    return false;
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(index.data()), sizeof(TileIndexEntry) * index.size());
+
+  size_t i = 0;
+  for (const auto &tile : tiles)
+  {
+    const TileIndexEntry &e = index[i++];
+    std::vector<char> pad(e.offset - static_cast<uint64_t>(file.tellp()), 0);
+    file.write(pad.data(), pad.size());
+    file.write(reinterpret_cast<const char *>(tile.second.data()), sizeof(TilePoint) * tile.second.size());
+  }
+  // pad the last block so every tile spans whole pages
+  std::vector<char> pad(offset - static_cast<uint64_t>(file.tellp()), 0);
+  file.write(pad.data(), pad.size());
+  return static_cast<bool>(file);
+}
+
+bool MapTileStore::isTilePath(const std::string &path)
+{
+  const std::string ext = ".tiles";
+  return path.size() > ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+}
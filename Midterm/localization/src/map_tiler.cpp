@@ -0,0 +1,62 @@
+/*
+ * Offline tool: split a PCD map into the memory-mapped tile format read by MapTileStore.
+ *
+ *   rosrun localization map_tiler <input.pcd> <output.tiles> [tile_size=50] [leaf_size=0]
+ *
+ * With leaf_size > 0 the map is voxelized first, so the runtime can skip the map-side
+ * downsampling.
+ */
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include <pcl/io/pcd_io.h>
+
+#include "localization/map_tile_store.h"
+#include "localization/thread_pool.h"
+#include "localization/voxel_hash_filter.h"
+
+int main(int argc, char *argv[])
+{
+  if (argc < 3)
+  {
+    std::cerr << "usage: map_tiler <input.pcd> <output.tiles> [tile_size=50] [leaf_size=0]" << std::endl;
+    return 1;
+  }
+  const std::string input = argv[1], output = argv[2];
+  const float tile_size = argc > 3 ? std::atof(argv[3]) : 50.f;
+  const float leaf_size = argc > 4 ? std::atof(argv[4]) : 0.f;
+
+  MapTileStore::Cloud::Ptr map(new MapTileStore::Cloud);
+  if (pcl::io::loadPCDFile<pcl::PointXYZI>(input, *map) != 0)
+  {
+    std::cerr << "failed to load " << input << std::endl;
+    return 1;
+  }
+  std::cout << "loaded " << map->size() << " points" << std::endl;
+
+  if (leaf_size > 0)
+  {
+    ThreadPool pool;
+    MapTileStore::Cloud::Ptr filtered(new MapTileStore::Cloud);
+    VoxelHashFilter(&pool).filter(*map, leaf_size, *filtered);
+    std::cout << "voxelized to " << filtered->size() << " points" << std::endl;
+    map = filtered;
+  }
+
+  if (!MapTileStore::write(output, *map, tile_size, leaf_size))
+  {
+    std::cerr << "failed to write " << output << std::endl;
+    return 1;
+  }
+
+  MapTileStore store;
+  if (!store.open(output))
+  {
+    std::cerr << "written file does not read back: " << output << std::endl;
+    return 1;
+  }
+  std::cout << "wrote " << store.tileCount() << " tiles, " << store.pointCount() << " points to " << output
+            << std::endl;
+  return 0;
+}
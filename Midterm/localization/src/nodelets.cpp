@@ -0,0 +1,43 @@
+/*
+ * localizer and pub_map as nodelets. Loaded into one manager with the lidar driver,
+ * scans and the map are passed as shared pointers instead of being serialized over
+ * TCPROS. Both run on the manager's multi-threaded callback queue, which replaces the
+ * AsyncSpinner of the standalone nodes (num_worker_threads on the manager).
+ */
+#include <memory>
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include "localization/localizer.h"
+#include "localization/map_publisher.h"
+
+namespace localization
+{
+class LocalizerNodelet : public nodelet::Nodelet
+{
+private:
+  void onInit() override
+  {
+    localizer.reset(new Localizer(getMTPrivateNodeHandle()));
+  }
+
+  std::unique_ptr<Localizer> localizer;
+};
+
+class MapPublisherNodelet : public nodelet::Nodelet
+{
+private:
+  void onInit() override
+  {
+    publisher.reset(new MapPublisher(getMTPrivateNodeHandle()));
+    if (!publisher->ready)
+      NODELET_ERROR("no map published");
+  }
+
+  std::unique_ptr<MapPublisher> publisher;
+};
+} // namespace localization
+
+PLUGINLIB_EXPORT_CLASS(localization::LocalizerNodelet, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(localization::MapPublisherNodelet, nodelet::Nodelet)
@@ -0,0 +1,198 @@
+#include "localization/parallel_icp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+ParallelIcpMatcher::ParallelIcpMatcher(const std::shared_ptr<ThreadPool> &pool, float voxel_resolution,
+                                       int voxel_capacity)
+    : pool_(pool), voxel_resolution_(voxel_resolution), voxel_capacity_(voxel_capacity)
+{
+  if (!pool_)
+    pool_ = std::make_shared<ThreadPool>();
+}
+
+void ParallelIcpMatcher::setTarget(const Cloud::ConstPtr &target)
+{
+  target_ = target;
+  if (voxel_resolution_ > 0)
+  {
+    voxels_ = std::make_shared<VoxelHashMap>(voxel_resolution_, voxel_capacity_);
+    voxels_->insert(*target_);
+    return;
+  }
+  tree_.reset(new Tree);
+  tree_->setInputCloud(target_);
+}
+
+ScanMatcher::Ptr ParallelIcpMatcher::clone() const
+{
+  std::shared_ptr<ParallelIcpMatcher> copy(new ParallelIcpMatcher(pool_, voxel_resolution_, voxel_capacity_));
+  copy->target_ = target_;
+  copy->tree_ = tree_;
+  copy->voxels_ = voxels_;
+  return copy;
+}
+
+bool ParallelIcpMatcher::updateTarget(const TargetUpdate &update)
+{
+  if (!voxels_)
+    return false;
+  // clones share voxels_ and may be aligning right now, they see the old or the new target
+  voxels_->apply(update.remove, update.keep_center, update.keep_radius, update.insert.get());
+  return true;
+}
+
+bool ParallelIcpMatcher::nearest(const Eigen::Vector3f &q, float max_distance, Search &search, Eigen::Vector3f &match,
+                                 float &d2) const
+{
+  if (voxels_)
+    return voxels_->nearest(q, max_distance, match, d2);
+
+  pcl::PointXYZI query;
+  query.getVector3fMap() = q;
+  if (tree_->nearestKSearch(query, 1, search.index, search.d2) < 1 || search.d2[0] > max_distance * max_distance)
+    return false;
+  match = target_->points[search.index[0]].getVector3fMap();
+  d2 = search.d2[0];
+  return true;
+}
+
+PointToPointSums ParallelIcpMatcher::linearize(const Eigen::Matrix4d &T, float max_distance)
+{
+  const size_t n = source_points_.size();
+  const size_t chunks = (n + kChunk - 1) / kChunk;
+  chunks_.resize(chunks);
+
+  const Eigen::Matrix4f Tf = T.cast<float>();
+  const float max_d2 = max_distance * max_distance;
+
+  pool_->parallelFor(chunks, [&](size_t c) {
+    Chunk &chunk = chunks_[c];
+    const size_t first = c * kChunk;
+    const size_t count = std::min(n, first + kChunk) - first;
+    chunk.query.resize(kChunk);
+    transformPoints(Tf, source_points_, first, count, chunk.query, 0);
+
+    chunk.source.clear();
+    chunk.matched.clear();
+    chunk.target.clear();
+    Search search;
+    Eigen::Vector3f m;
+    float d2;
+    for (size_t i = 0; i < count; ++i)
+    {
+      const Eigen::Vector3f q(chunk.query.x[i], chunk.query.y[i], chunk.query.z[i]);
+      if (!nearest(q, max_distance, search, m, d2))
+        continue;
+      chunk.source.push_back(source_points_.x[first + i], source_points_.y[first + i], source_points_.z[first + i]);
+      chunk.matched.push_back(q.x(), q.y(), q.z());
+      chunk.target.push_back(m.x(), m.y(), m.z());
+    }
+    // left perturbation: r = exp(dx) q - m, J = [-[q]x, I]
+    chunk.sums = accumulatePointToPoint(chunk.matched, chunk.target, chunk.matched.size());
+  });
+  matched_d2_ = max_d2;
+
+  // fixed order reduction keeps the sum independent of scheduling
+  PointToPointSums total;
+  for (const Chunk &chunk : chunks_)
+    total += chunk.sums;
+  return total;
+}
+
+void ParallelIcpMatcher::align(const Cloud::ConstPtr &source, const Eigen::Matrix4f &guess, const Settings &settings)
+{
+  source_ = source;
+  final_ = guess.cast<double>();
+  converged_ = false;
+  iterations_ = 0;
+  matched_d2_ = 0;
+  if (!hasTarget() || !source_ || source_->empty())
+    return;
+  // target edits wait until the alignment is done
+  VoxelHashMap::ReadLock lock;
+  if (voxels_)
+    lock = voxels_->readLock();
+  if (voxels_ ? voxels_->sizeLocked() == 0 : target_->empty())
+    return;
+  source_points_.assign(*source_);
+
+  GaussNewtonStep step(settings.transformation_epsilon, settings.fitness_epsilon);
+  while (iterations_ < settings.iterations)
+  {
+    PointToPointSums total = linearize(final_, settings.max_distance);
+    ++iterations_;
+    if (total.count < 6)
+      return;
+
+    Matrix6d H;
+    Vector6d b;
+    total.normalEquations(H, b);
+    GaussNewtonStep::Status status = step.apply(H, b, total.rr, total.count, final_);
+    if (status == GaussNewtonStep::Failed)
+      return;
+    if (status == GaussNewtonStep::Converged)
+      break;
+  }
+  converged_ = true;
+}
+
+double ParallelIcpMatcher::fitness(double max_range)
+{
+  inlier_ratio_ = 0;
+  if (!hasTarget() || !source_ || source_->empty())
+    return std::numeric_limits<double>::max();
+
+  const size_t n = source_points_.size();
+  const size_t chunks = (n + kChunk - 1) / kChunk;
+  chunks_.resize(chunks);
+  const Eigen::Matrix4f Tf = final_.cast<float>();
+  // points without a correspondence were farther than sqrt(matched_d2_) and would not count
+  const bool reuse = max_range <= matched_d2_;
+  // max_range bounds the squared distance, as in Registration::getFitnessScore()
+  const float max_distance = static_cast<float>(std::sqrt(std::min(max_range, 1e12)));
+  VoxelHashMap::ReadLock lock;
+  if (voxels_ && !reuse)
+    lock = voxels_->readLock();
+
+  pool_->parallelFor(chunks, [&](size_t c) {
+    Chunk &chunk = chunks_[c];
+    chunk.inlier_sum = 0;
+    chunk.inliers = 0;
+    if (reuse)
+    {
+      // the final step moved the points, the correspondences stay
+      transformPoints(Tf, chunk.source, chunk.matched);
+      accumulateInliers(chunk.matched, chunk.target, chunk.matched.size(), max_range, chunk.inlier_sum,
+                        chunk.inliers);
+      return;
+    }
+
+    const size_t first = c * kChunk;
+    const size_t count = std::min(n, first + kChunk) - first;
+    chunk.query.resize(kChunk);
+    transformPoints(Tf, source_points_, first, count, chunk.query, 0);
+    Search search;
+    Eigen::Vector3f m;
+    float d2;
+    for (size_t i = 0; i < count; ++i)
+    {
+      const Eigen::Vector3f q(chunk.query.x[i], chunk.query.y[i], chunk.query.z[i]);
+      if (!nearest(q, max_distance, search, m, d2))
+        continue;
+      chunk.inlier_sum += d2;
+      ++chunk.inliers;
+    }
+  });
+
+  double error = 0;
+  size_t count = 0;
+  for (const Chunk &chunk : chunks_)
+  {
+    error += chunk.inlier_sum;
+    count += chunk.inliers;
+  }
+  inlier_ratio_ = static_cast<double>(count) / n;
+  return count > 0 ? error / count : std::numeric_limits<double>::max();
+}
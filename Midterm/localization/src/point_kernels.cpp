@@ -0,0 +1,454 @@
+#include "localization/point_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define LOCALIZATION_KERNELS_AVX2
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define LOCALIZATION_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+/* Row-major top 3x4 of a rigid transform */
+struct Rigid
+{
+  float m[12];
+
+  explicit Rigid(const Eigen::Matrix4f &T)
+  {
+    for (int r = 0; r < 3; ++r)
+      for (int c = 0; c < 4; ++c)
+        m[4 * r + c] = T(r, c);
+  }
+};
+
+void transformScalar(const Rigid &T, const float *x, const float *y, const float *z, size_t n, float *ox, float *oy,
+                     float *oz)
+{
+  const float *m = T.m;
+  for (size_t i = 0; i < n; ++i)
+  {
+    const float px = x[i], py = y[i], pz = z[i];
+    ox[i] = m[0] * px + m[1] * py + m[2] * pz + m[3];
+    oy[i] = m[4] * px + m[5] * py + m[6] * pz + m[7];
+    oz[i] = m[8] * px + m[9] * py + m[10] * pz + m[11];
+  }
+}
+
+void accumulateScalar(const float *qx, const float *qy, const float *qz, const float *mx, const float *my,
+                      const float *mz, size_t n, PointToPointSums &s)
+{
+  for (size_t i = 0; i < n; ++i)
+  {
+    const double x = qx[i], y = qy[i], z = qz[i];
+    const double rx = x - mx[i], ry = y - my[i], rz = z - mz[i];
+    s.q[0] += x;
+    s.q[1] += y;
+    s.q[2] += z;
+    s.qq[0] += x * x;
+    s.qq[1] += x * y;
+    s.qq[2] += x * z;
+    s.qq[3] += y * y;
+    s.qq[4] += y * z;
+    s.qq[5] += z * z;
+    s.q_cross_r[0] += y * rz - z * ry;
+    s.q_cross_r[1] += z * rx - x * rz;
+    s.q_cross_r[2] += x * ry - y * rx;
+    s.r[0] += rx;
+    s.r[1] += ry;
+    s.r[2] += rz;
+    s.rr += rx * rx + ry * ry + rz * rz;
+  }
+  s.count += n;
+}
+
+void inliersScalar(const float *qx, const float *qy, const float *qz, const float *mx, const float *my,
+                   const float *mz, size_t n, double max_d2, double &sum, size_t &count)
+{
+  for (size_t i = 0; i < n; ++i)
+  {
+    const double dx = qx[i] - mx[i], dy = qy[i] - my[i], dz = qz[i] - mz[i];
+    const double d2 = dx * dx + dy * dy + dz * dz;
+    if (d2 <= max_d2)
+    {
+      sum += d2;
+      ++count;
+    }
+  }
+}
+
+#ifdef LOCALIZATION_KERNELS_AVX2
+bool hasAvx2()
+{
+  static const bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return has;
+}
+
+__attribute__((target("avx2,fma"))) double hsum(__m256d v)
+{
+  alignas(32) double lanes[4];
+  _mm256_store_pd(lanes, v);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+__attribute__((target("avx2,fma"))) void transformAvx2(const Rigid &T, const float *x, const float *y,
+                                                       const float *z, size_t n, float *ox, float *oy, float *oz)
+{
+  const float *m = T.m;
+  const __m256 m00 = _mm256_set1_ps(m[0]), m01 = _mm256_set1_ps(m[1]), m02 = _mm256_set1_ps(m[2]),
+               m03 = _mm256_set1_ps(m[3]);
+  const __m256 m10 = _mm256_set1_ps(m[4]), m11 = _mm256_set1_ps(m[5]), m12 = _mm256_set1_ps(m[6]),
+               m13 = _mm256_set1_ps(m[7]);
+  const __m256 m20 = _mm256_set1_ps(m[8]), m21 = _mm256_set1_ps(m[9]), m22 = _mm256_set1_ps(m[10]),
+               m23 = _mm256_set1_ps(m[11]);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    const __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i), pz = _mm256_loadu_ps(z + i);
+    _mm256_storeu_ps(ox + i, _mm256_fmadd_ps(m00, px, _mm256_fmadd_ps(m01, py, _mm256_fmadd_ps(m02, pz, m03))));
+    _mm256_storeu_ps(oy + i, _mm256_fmadd_ps(m10, px, _mm256_fmadd_ps(m11, py, _mm256_fmadd_ps(m12, pz, m13))));
+    _mm256_storeu_ps(oz + i, _mm256_fmadd_ps(m20, px, _mm256_fmadd_ps(m21, py, _mm256_fmadd_ps(m22, pz, m23))));
+  }
+  transformScalar(T, x + i, y + i, z + i, n - i, ox + i, oy + i, oz + i);
+}
+
+__attribute__((target("avx2,fma"))) void accumulateAvx2(const float *qx, const float *qy, const float *qz,
+                                                        const float *mx, const float *my, const float *mz, size_t n,
+                                                        PointToPointSums &s)
+{
+  __m256d sx = _mm256_setzero_pd(), sy = sx, sz = sx;
+  __m256d sxx = sx, sxy = sx, sxz = sx, syy = sx, syz = sx, szz = sx;
+  __m256d cx = sx, cy = sx, cz = sx;
+  __m256d srx = sx, sry = sx, srz = sx, srr = sx;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    const __m256d x = _mm256_cvtps_pd(_mm_loadu_ps(qx + i));
+    const __m256d y = _mm256_cvtps_pd(_mm_loadu_ps(qy + i));
+    const __m256d z = _mm256_cvtps_pd(_mm_loadu_ps(qz + i));
+    const __m256d rx = _mm256_sub_pd(x, _mm256_cvtps_pd(_mm_loadu_ps(mx + i)));
+    const __m256d ry = _mm256_sub_pd(y, _mm256_cvtps_pd(_mm_loadu_ps(my + i)));
+    const __m256d rz = _mm256_sub_pd(z, _mm256_cvtps_pd(_mm_loadu_ps(mz + i)));
+    sx = _mm256_add_pd(sx, x);
+    sy = _mm256_add_pd(sy, y);
+    sz = _mm256_add_pd(sz, z);
+    sxx = _mm256_fmadd_pd(x, x, sxx);
+    sxy = _mm256_fmadd_pd(x, y, sxy);
+    sxz = _mm256_fmadd_pd(x, z, sxz);
+    syy = _mm256_fmadd_pd(y, y, syy);
+    syz = _mm256_fmadd_pd(y, z, syz);
+    szz = _mm256_fmadd_pd(z, z, szz);
+    cx = _mm256_add_pd(cx, _mm256_fmsub_pd(y, rz, _mm256_mul_pd(z, ry)));
+    cy = _mm256_add_pd(cy, _mm256_fmsub_pd(z, rx, _mm256_mul_pd(x, rz)));
+    cz = _mm256_add_pd(cz, _mm256_fmsub_pd(x, ry, _mm256_mul_pd(y, rx)));
+    srx = _mm256_add_pd(srx, rx);
+    sry = _mm256_add_pd(sry, ry);
+    srz = _mm256_add_pd(srz, rz);
+    srr = _mm256_fmadd_pd(rx, rx, _mm256_fmadd_pd(ry, ry, _mm256_fmadd_pd(rz, rz, srr)));
+  }
+  s.q[0] += hsum(sx);
+  s.q[1] += hsum(sy);
+  s.q[2] += hsum(sz);
+  s.qq[0] += hsum(sxx);
+  s.qq[1] += hsum(sxy);
+  s.qq[2] += hsum(sxz);
+  s.qq[3] += hsum(syy);
+  s.qq[4] += hsum(syz);
+  s.qq[5] += hsum(szz);
+  s.q_cross_r[0] += hsum(cx);
+  s.q_cross_r[1] += hsum(cy);
+  s.q_cross_r[2] += hsum(cz);
+  s.r[0] += hsum(srx);
+  s.r[1] += hsum(sry);
+  s.r[2] += hsum(srz);
+  s.rr += hsum(srr);
+  s.count += i;
+  accumulateScalar(qx + i, qy + i, qz + i, mx + i, my + i, mz + i, n - i, s);
+}
+
+__attribute__((target("avx2,fma"))) void inliersAvx2(const float *qx, const float *qy, const float *qz,
+                                                     const float *mx, const float *my, const float *mz, size_t n,
+                                                     double max_d2, double &sum, size_t &count)
+{
+  const __m256d limit = _mm256_set1_pd(max_d2), one = _mm256_set1_pd(1.);
+  __m256d s = _mm256_setzero_pd(), c = s;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    const __m256d dx = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(qx + i)), _mm256_cvtps_pd(_mm_loadu_ps(mx + i)));
+    const __m256d dy = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(qy + i)), _mm256_cvtps_pd(_mm_loadu_ps(my + i)));
+    const __m256d dz = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(qz + i)), _mm256_cvtps_pd(_mm_loadu_ps(mz + i)));
+    const __m256d d2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dz, dz)));
+    const __m256d inlier = _mm256_cmp_pd(d2, limit, _CMP_LE_OQ);
+    s = _mm256_add_pd(s, _mm256_and_pd(inlier, d2));
+    c = _mm256_add_pd(c, _mm256_and_pd(inlier, one));
+  }
+  sum += hsum(s);
+  count += static_cast<size_t>(hsum(c));
+  inliersScalar(qx + i, qy + i, qz + i, mx + i, my + i, mz + i, n - i, max_d2, sum, count);
+}
+#endif
+
+#ifdef LOCALIZATION_KERNELS_NEON
+void transformNeon(const Rigid &T, const float *x, const float *y, const float *z, size_t n, float *ox, float *oy,
+                   float *oz)
+{
+  const float *m = T.m;
+  const float32x4_t m00 = vdupq_n_f32(m[0]), m01 = vdupq_n_f32(m[1]), m02 = vdupq_n_f32(m[2]),
+                    m03 = vdupq_n_f32(m[3]);
+  const float32x4_t m10 = vdupq_n_f32(m[4]), m11 = vdupq_n_f32(m[5]), m12 = vdupq_n_f32(m[6]),
+                    m13 = vdupq_n_f32(m[7]);
+  const float32x4_t m20 = vdupq_n_f32(m[8]), m21 = vdupq_n_f32(m[9]), m22 = vdupq_n_f32(m[10]),
+                    m23 = vdupq_n_f32(m[11]);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    const float32x4_t px = vld1q_f32(x + i), py = vld1q_f32(y + i), pz = vld1q_f32(z + i);
+    vst1q_f32(ox + i, vfmaq_f32(vfmaq_f32(vfmaq_f32(m03, m02, pz), m01, py), m00, px));
+    vst1q_f32(oy + i, vfmaq_f32(vfmaq_f32(vfmaq_f32(m13, m12, pz), m11, py), m10, px));
+    vst1q_f32(oz + i, vfmaq_f32(vfmaq_f32(vfmaq_f32(m23, m22, pz), m21, py), m20, px));
+  }
+  transformScalar(T, x + i, y + i, z + i, n - i, ox + i, oy + i, oz + i);
+}
+
+void accumulateNeon(const float *qx, const float *qy, const float *qz, const float *mx, const float *my,
+                    const float *mz, size_t n, PointToPointSums &s)
+{
+  float64x2_t sx = vdupq_n_f64(0), sy = sx, sz = sx;
+  float64x2_t sxx = sx, sxy = sx, sxz = sx, syy = sx, syz = sx, szz = sx;
+  float64x2_t cx = sx, cy = sx, cz = sx;
+  float64x2_t srx = sx, sry = sx, srz = sx, srr = sx;
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+  {
+    const float64x2_t x = vcvt_f64_f32(vld1_f32(qx + i));
+    const float64x2_t y = vcvt_f64_f32(vld1_f32(qy + i));
+    const float64x2_t z = vcvt_f64_f32(vld1_f32(qz + i));
+    const float64x2_t rx = vsubq_f64(x, vcvt_f64_f32(vld1_f32(mx + i)));
+    const float64x2_t ry = vsubq_f64(y, vcvt_f64_f32(vld1_f32(my + i)));
+    const float64x2_t rz = vsubq_f64(z, vcvt_f64_f32(vld1_f32(mz + i)));
+    sx = vaddq_f64(sx, x);
+    sy = vaddq_f64(sy, y);
+    sz = vaddq_f64(sz, z);
+    sxx = vfmaq_f64(sxx, x, x);
+    sxy = vfmaq_f64(sxy, x, y);
+    sxz = vfmaq_f64(sxz, x, z);
+    syy = vfmaq_f64(syy, y, y);
+    syz = vfmaq_f64(syz, y, z);
+    szz = vfmaq_f64(szz, z, z);
+    cx = vaddq_f64(cx, vfmsq_f64(vmulq_f64(y, rz), z, ry));
+    cy = vaddq_f64(cy, vfmsq_f64(vmulq_f64(z, rx), x, rz));
+    cz = vaddq_f64(cz, vfmsq_f64(vmulq_f64(x, ry), y, rx));
+    srx = vaddq_f64(srx, rx);
+    sry = vaddq_f64(sry, ry);
+    srz = vaddq_f64(srz, rz);
+    srr = vfmaq_f64(vfmaq_f64(vfmaq_f64(srr, rz, rz), ry, ry), rx, rx);
+  }
+  s.q[0] += vaddvq_f64(sx);
+  s.q[1] += vaddvq_f64(sy);
+  s.q[2] += vaddvq_f64(sz);
+  s.qq[0] += vaddvq_f64(sxx);
+  s.qq[1] += vaddvq_f64(sxy);
+  s.qq[2] += vaddvq_f64(sxz);
+  s.qq[3] += vaddvq_f64(syy);
+  s.qq[4] += vaddvq_f64(syz);
+  s.qq[5] += vaddvq_f64(szz);
+  s.q_cross_r[0] += vaddvq_f64(cx);
+  s.q_cross_r[1] += vaddvq_f64(cy);
+  s.q_cross_r[2] += vaddvq_f64(cz);
+  s.r[0] += vaddvq_f64(srx);
+  s.r[1] += vaddvq_f64(sry);
+  s.r[2] += vaddvq_f64(srz);
+  s.rr += vaddvq_f64(srr);
+  s.count += i;
+  accumulateScalar(qx + i, qy + i, qz + i, mx + i, my + i, mz + i, n - i, s);
+}
+
+void inliersNeon(const float *qx, const float *qy, const float *qz, const float *mx, const float *my,
+                 const float *mz, size_t n, double max_d2, double &sum, size_t &count)
+{
+  const float64x2_t limit = vdupq_n_f64(max_d2), one = vdupq_n_f64(1.);
+  float64x2_t s = vdupq_n_f64(0), c = s;
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+  {
+    const float64x2_t dx = vsubq_f64(vcvt_f64_f32(vld1_f32(qx + i)), vcvt_f64_f32(vld1_f32(mx + i)));
+    const float64x2_t dy = vsubq_f64(vcvt_f64_f32(vld1_f32(qy + i)), vcvt_f64_f32(vld1_f32(my + i)));
+    const float64x2_t dz = vsubq_f64(vcvt_f64_f32(vld1_f32(qz + i)), vcvt_f64_f32(vld1_f32(mz + i)));
+    const float64x2_t d2 = vfmaq_f64(vfmaq_f64(vmulq_f64(dz, dz), dy, dy), dx, dx);
+    const uint64x2_t inlier = vcleq_f64(d2, limit);
+    s = vaddq_f64(s, vreinterpretq_f64_u64(vandq_u64(inlier, vreinterpretq_u64_f64(d2))));
+    c = vaddq_f64(c, vreinterpretq_f64_u64(vandq_u64(inlier, vreinterpretq_u64_f64(one))));
+  }
+  sum += vaddvq_f64(s);
+  count += static_cast<size_t>(vaddvq_f64(c));
+  inliersScalar(qx + i, qy + i, qz + i, mx + i, my + i, mz + i, n - i, max_d2, sum, count);
+}
+#endif
+
+void transformArrays(const Rigid &T, const float *x, const float *y, const float *z, size_t n, float *ox, float *oy,
+                     float *oz)
+{
+#if defined(LOCALIZATION_KERNELS_AVX2)
+  if (hasAvx2())
+    return transformAvx2(T, x, y, z, n, ox, oy, oz);
+#elif defined(LOCALIZATION_KERNELS_NEON)
+  return transformNeon(T, x, y, z, n, ox, oy, oz);
+#endif
+  transformScalar(T, x, y, z, n, ox, oy, oz);
+}
+}
+
+void transformPoints(const Eigen::Matrix4f &T, const PointBuffer &in, size_t first, size_t n, PointBuffer &out,
+                     size_t out_first)
+{
+  transformArrays(Rigid(T), in.x.data() + first, in.y.data() + first, in.z.data() + first, n,
+                  out.x.data() + out_first, out.y.data() + out_first, out.z.data() + out_first);
+}
+
+void transformPoints(const Eigen::Matrix4f &T, const PointBuffer &in, PointBuffer &out)
+{
+  out.resize(in.size());
+  transformPoints(T, in, 0, in.size(), out, 0);
+}
+
+void transformPacked(const Eigen::Matrix4f &T, uint8_t *data, size_t count, size_t step, size_t x_offset,
+                     size_t y_offset, size_t z_offset)
+{
+  // de-interleave a block at a time so the SoA kernel runs on cache-resident arrays
+  const size_t kBlock = 256;
+  float x[kBlock], y[kBlock], z[kBlock];
+  const Rigid rigid(T);
+  for (size_t first = 0; first < count; first += kBlock)
+  {
+    const size_t n = std::min(kBlock, count - first);
+    uint8_t *block = data + first * step;
+    for (size_t i = 0; i < n; ++i)
+    {
+      std::memcpy(&x[i], block + i * step + x_offset, sizeof(float));
+      std::memcpy(&y[i], block + i * step + y_offset, sizeof(float));
+      std::memcpy(&z[i], block + i * step + z_offset, sizeof(float));
+    }
+    transformArrays(rigid, x, y, z, n, x, y, z);
+    for (size_t i = 0; i < n; ++i)
+    {
+      std::memcpy(block + i * step + x_offset, &x[i], sizeof(float));
+      std::memcpy(block + i * step + y_offset, &y[i], sizeof(float));
+      std::memcpy(block + i * step + z_offset, &z[i], sizeof(float));
+    }
+  }
+}
+
+PointToPointSums &PointToPointSums::operator+=(const PointToPointSums &other)
+{
+  count += other.count;
+  for (int i = 0; i < 3; ++i)
+  {
+    q[i] += other.q[i];
+    q_cross_r[i] += other.q_cross_r[i];
+    r[i] += other.r[i];
+  }
+  for (int i = 0; i < 6; ++i)
+    qq[i] += other.qq[i];
+  rr += other.rr;
+  return *this;
+}
+
+void PointToPointSums::normalEquations(Eigen::Matrix<double, 6, 6> &H, Eigen::Matrix<double, 6, 1> &b) const
+{
+  // J^T J = [sum(|q|^2 I - q q^T), [sum q]x; -[sum q]x, n I], J^T r = [sum q x r; sum r]
+  Eigen::Matrix3d S;
+  S << qq[0], qq[1], qq[2], qq[1], qq[3], qq[4], qq[2], qq[4], qq[5];
+  Eigen::Matrix3d Q;
+  Q << 0, -q[2], q[1], q[2], 0, -q[0], -q[1], q[0], 0;
+  H.topLeftCorner<3, 3>() = S.trace() * Eigen::Matrix3d::Identity() - S;
+  H.topRightCorner<3, 3>() = Q;
+  H.bottomLeftCorner<3, 3>() = -Q;
+  H.bottomRightCorner<3, 3>() = count * Eigen::Matrix3d::Identity();
+  b << q_cross_r[0], q_cross_r[1], q_cross_r[2], r[0], r[1], r[2];
+}
+
+PointToPointSums accumulatePointToPoint(const PointBuffer &q, const PointBuffer &m, size_t n)
+{
+  PointToPointSums sums;
+  const float *qx = q.x.data(), *qy = q.y.data(), *qz = q.z.data();
+  const float *mx = m.x.data(), *my = m.y.data(), *mz = m.z.data();
+#if defined(LOCALIZATION_KERNELS_AVX2)
+  if (hasAvx2())
+  {
+    accumulateAvx2(qx, qy, qz, mx, my, mz, n, sums);
+    return sums;
+  }
+#elif defined(LOCALIZATION_KERNELS_NEON)
+  accumulateNeon(qx, qy, qz, mx, my, mz, n, sums);
+  return sums;
+#endif
+  accumulateScalar(qx, qy, qz, mx, my, mz, n, sums);
+  return sums;
+}
+
+void accumulateInliers(const PointBuffer &q, const PointBuffer &m, size_t n, double max_d2, double &sum,
+                       size_t &count)
+{
+  const float *qx = q.x.data(), *qy = q.y.data(), *qz = q.z.data();
+  const float *mx = m.x.data(), *my = m.y.data(), *mz = m.z.data();
+#if defined(LOCALIZATION_KERNELS_AVX2)
+  if (hasAvx2())
+    return inliersAvx2(qx, qy, qz, mx, my, mz, n, max_d2, sum, count);
+#elif defined(LOCALIZATION_KERNELS_NEON)
+  return inliersNeon(qx, qy, qz, mx, my, mz, n, max_d2, sum, count);
+#endif
+  inliersScalar(qx, qy, qz, mx, my, mz, n, max_d2, sum, count);
+}
+
+Eigen::Matrix4d expSe3(const Eigen::Matrix<double, 6, 1> &delta)
+{
+  Eigen::Matrix4d T = Eigen::Matrix4d::Identity();
+  Eigen::Vector3d w = delta.head<3>();
+  double angle = w.norm();
+  if (angle > 1e-12)
+    T.topLeftCorner<3, 3>() = Eigen::AngleAxisd(angle, w / angle).toRotationMatrix();
+  T.topRightCorner<3, 1>() = delta.tail<3>();
+  return T;
+}
+
+Eigen::Matrix3d skew(const Eigen::Vector3d &v)
+{
+  Eigen::Matrix3d m;
+  m << 0, -v.z(), v.y(), v.z(), 0, -v.x(), -v.y(), v.x(), 0;
+  return m;
+}
+
+GaussNewtonStep::Status GaussNewtonStep::apply(const Eigen::Matrix<double, 6, 6> &H,
+                                               const Eigen::Matrix<double, 6, 1> &b, double rr, double count,
+                                               Eigen::Matrix4d &T)
+{
+  Eigen::Matrix<double, 6, 1> delta = H.ldlt().solve(-b);
+  if (!delta.allFinite())
+    return Failed;
+  T = expSe3(delta) * T;
+
+  double mse = rr / count;
+  double rotation = 1. - std::cos(delta.head<3>().norm());
+  double translation = delta.tail<3>().squaredNorm();
+  bool small_step = rotation < transformation_epsilon_ && translation < transformation_epsilon_;
+  bool small_change = std::abs(previous_mse_ - mse) < fitness_epsilon_ * mse;
+  previous_mse_ = mse;
+  return small_step || small_change ? Converged : Continue;
+}
+
+const char *pointKernelIsa()
+{
+#if defined(LOCALIZATION_KERNELS_AVX2)
+  return hasAvx2() ? "avx2" : "scalar";
+#elif defined(LOCALIZATION_KERNELS_NEON)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
@@ -0,0 +1,73 @@
+#include "localization/pose_predictor.h"
+
+#include <cmath>
+
+void PosePredictor::reset()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  history_ = 0;
+}
+
+void PosePredictor::update(double stamp, const Eigen::Matrix4f &pose)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  previous_stamp_ = stamp_;
+  previous_pose_ = pose_;
+  stamp_ = stamp;
+  pose_ = pose;
+  if (history_ < 2)
+    ++history_;
+}
+
+double PosePredictor::lastStamp() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return history_ > 0 ? stamp_ : -1;
+}
+
+bool PosePredictor::twist(Eigen::Vector3f &linear, float &yaw_rate) const
+{
+  const double dt = stamp_ - previous_stamp_;
+  if (history_ < 2 || dt <= 0 || dt > options_.max_gap)
+    return false;
+
+  // motion of the last interval in the frame of the older pose; with a constant turn rate
+  // the chord points along the mid-interval heading, rotate it into the newest frame
+  Eigen::Matrix4f delta = previous_pose_.inverse() * pose_;
+  const float turned = std::atan2(delta(1, 0), delta(0, 0));
+  linear = Eigen::AngleAxisf(-turned / 2, Eigen::Vector3f::UnitZ()) * delta.block<3, 1>(0, 3) / dt;
+  yaw_rate = turned / dt;
+  return true;
+}
+
+bool PosePredictor::velocity(Eigen::Vector3f &linear, float &yaw_rate) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return twist(linear, yaw_rate);
+}
+
+bool PosePredictor::predict(double stamp, Eigen::Matrix4f &pose, const Eigen::Matrix3f *measured_rotation) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (history_ == 0)
+    return false;
+
+  pose = pose_;
+  const double tau = stamp - stamp_;
+  Eigen::Vector3f velocity;
+  float yaw_rate;
+  if (tau <= 0 || tau > options_.max_gap || !twist(velocity, yaw_rate))
+    return true;
+
+  Eigen::Quaternionf rotation(Eigen::AngleAxisf(yaw_rate * tau, Eigen::Vector3f::UnitZ()));
+  if (measured_rotation && options_.imu_weight > 0)
+    rotation = rotation.slerp(options_.imu_weight, Eigen::Quaternionf(*measured_rotation));
+
+  Eigen::Matrix4f step(Eigen::Matrix4f::Identity());
+  step.topLeftCorner<3, 3>() = rotation.normalized().toRotationMatrix();
+  // the path follows the chord at the mid-interval heading
+  Eigen::Quaternionf half = Eigen::Quaternionf::Identity().slerp(0.5f, rotation);
+  step.block<3, 1>(0, 3) = half * velocity * tau;
+  pose = pose_ * step;
+  return true;
+}
@@ -0,0 +1,187 @@
+#include "localization/scan_decoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+inline float read_float(const uint8_t *p)
+{
+  float v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline float read_intensity(const uint8_t *point, const RawCloudView &view)
+{
+  switch (view.intensity_type)
+  {
+  case RawCloudView::Float32:
+    return read_float(point + view.intensity_offset);
+  case RawCloudView::Uint8:
+    return point[view.intensity_offset];
+  case RawCloudView::Uint16:
+  {
+    uint16_t v;
+    std::memcpy(&v, point + view.intensity_offset, sizeof(v));
+    return v;
+  }
+  default:
+    return 0.f;
+  }
+}
+
+inline double read_time(const uint8_t *point, const RawCloudView &view)
+{
+  switch (view.time_type)
+  {
+  case RawCloudView::Seconds32:
+    return read_float(point + view.time_offset);
+  case RawCloudView::Seconds64:
+  {
+    double v;
+    std::memcpy(&v, point + view.time_offset, sizeof(v));
+    return v;
+  }
+  case RawCloudView::Nanoseconds32:
+  {
+    uint32_t v;
+    std::memcpy(&v, point + view.time_offset, sizeof(v));
+    return v * 1e-9;
+  }
+  default:
+    return 0.;
+  }
+}
+}
+
+RawCloudView RawCloudView::fromCloud(const pcl::PointCloud<pcl::PointXYZI> &cloud)
+{
+  RawCloudView view;
+  view.data = reinterpret_cast<const uint8_t *>(cloud.points.data());
+  view.width = cloud.points.size();
+  view.height = 1;
+  view.point_step = sizeof(pcl::PointXYZI);
+  view.row_step = view.point_step * view.width;
+  view.x_offset = offsetof(pcl::PointXYZI, x);
+  view.y_offset = offsetof(pcl::PointXYZI, y);
+  view.z_offset = offsetof(pcl::PointXYZI, z);
+  view.intensity_offset = offsetof(pcl::PointXYZI, intensity);
+  view.intensity_type = Float32;
+  return view;
+}
+
+bool ScanFilter::parseBoxes(const std::vector<float> &flat, std::vector<Box> &boxes)
+{
+  boxes.clear();
+  if (flat.size() % 6 != 0)
+    return false;
+  for (size_t i = 0; i < flat.size(); i += 6)
+  {
+    Box box;
+    for (int k = 0; k < 3; ++k)
+    {
+      box.min[k] = std::min(flat[i + k], flat[i + 3 + k]);
+      box.max[k] = std::max(flat[i + k], flat[i + 3 + k]);
+    }
+    boxes.push_back(box);
+  }
+  return true;
+}
+
+void ScanDecoder::decode(const RawCloudView &view, float leaf, Cloud &out, const ScanFilter &filter,
+                         const SweepMotion *motion)
+{
+  index_.clear();
+  voxels_.clear();
+  const float inv_leaf = 1.f / leaf;
+  const bool unfiltered = filter.empty();
+  const bool timed = view.time_type != RawCloudView::NoTime;
+  // absolute per-point times are made relative to the stamp, relative ones and azimuths
+  // are offsets into the sweep and get shifted to the reference
+  bool first = true;
+  double time_base = 0;
+  float start_azimuth = 0;
+
+  for (uint32_t row = 0; row < view.height; ++row)
+  {
+    const uint8_t *point = view.data + static_cast<size_t>(row) * view.row_step;
+    for (uint32_t col = 0; col < view.width; ++col, point += view.point_step)
+    {
+      float x = read_float(point + view.x_offset);
+      float y = read_float(point + view.y_offset);
+      float z = read_float(point + view.z_offset);
+      if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z))
+        continue;
+      if (!unfiltered && !filter.keep(x, y, z))
+        continue;
+
+      if (motion)
+      {
+        float t;
+        if (timed)
+        {
+          double time = read_time(point, view);
+          if (first)
+            time_base = time > 1e6 ? view.stamp : static_cast<double>(motion->reference) * motion->period;
+          t = static_cast<float>(time - time_base);
+        }
+        else
+        {
+          float azimuth = std::atan2(y, x);
+          if (first)
+            start_azimuth = azimuth;
+          float turned = motion->clockwise ? start_azimuth - azimuth : azimuth - start_azimuth;
+          turned -= 2 * static_cast<float>(M_PI) * std::floor(turned / (2 * static_cast<float>(M_PI)));
+          t = (turned / (2 * static_cast<float>(M_PI)) - motion->reference) * motion->period;
+        }
+        first = false;
+
+        // second order rotation p + w x p + (w x (w x p)) / 2 plus translation, w = angular * t
+        Eigen::Vector3f p(x, y, z);
+        Eigen::Vector3f w = motion->angular * t;
+        Eigen::Vector3f wp = w.cross(p);
+        p += wp + 0.5f * w.cross(wp) + motion->linear * t;
+        x = p.x();
+        y = p.y();
+        z = p.z();
+      }
+
+      VoxelKey key;
+      if (!VoxelKey::of(x, y, z, inv_leaf, key))
+        continue;
+
+      float intensity = read_intensity(point, view);
+      auto inserted = index_.emplace(key, static_cast<uint32_t>(voxels_.size()));
+      if (inserted.second)
+      {
+        voxels_.push_back(Voxel{x, y, z, intensity, 1});
+      }
+      else
+      {
+        Voxel &v = voxels_[inserted.first->second];
+        v.x += x;
+        v.y += y;
+        v.z += z;
+        v.intensity += intensity;
+        ++v.count;
+      }
+    }
+  }
+
+  out.points.resize(voxels_.size());
+  for (size_t i = 0; i < voxels_.size(); ++i)
+  {
+    const Voxel &v = voxels_[i];
+    const float inv = 1.f / v.count;
+    pcl::PointXYZI &p = out.points[i];
+    p.x = v.x * inv;
+    p.y = v.y * inv;
+    p.z = v.z * inv;
+    p.intensity = v.intensity * inv;
+  }
+  out.width = out.points.size();
+  out.height = 1;
+  out.is_dense = true;
+}
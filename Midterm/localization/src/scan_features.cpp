@@ -0,0 +1,133 @@
+#include "localization/scan_features.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <Eigen/Dense>
+
+void ScanFeatureExtractor::extract(const Cloud &scan, Cloud &edges, Cloud &planes)
+{
+  edges.clear();
+  planes.clear();
+  const int window = std::max(1, options_.window);
+  const int rings = std::max(1, options_.rings);
+  const int sectors = std::max(1, options_.sectors);
+
+  // elevation in the curvature slot until the rings are known
+  entries_.clear();
+  float min_elevation = std::numeric_limits<float>::max(), max_elevation = -min_elevation;
+  for (size_t i = 0; i < scan.size(); ++i)
+  {
+    const pcl::PointXYZI &p = scan.points[i];
+    float planar = std::sqrt(p.x * p.x + p.y * p.y);
+    float range = std::sqrt(planar * planar + p.z * p.z);
+    if (!std::isfinite(range) || range < 1e-3f)
+      continue;
+    Entry entry;
+    entry.index = static_cast<uint32_t>(i);
+    entry.ring = 0;
+    entry.azimuth = std::atan2(p.y, p.x);
+    entry.range = range;
+    entry.curvature = std::atan2(p.z, planar);
+    min_elevation = std::min(min_elevation, entry.curvature);
+    max_elevation = std::max(max_elevation, entry.curvature);
+    entries_.push_back(entry);
+  }
+  if (entries_.size() < static_cast<size_t>(2 * window + 1))
+    return;
+
+  float scale = rings / std::max(max_elevation - min_elevation, 1e-6f);
+  for (Entry &entry : entries_)
+    entry.ring = std::min(rings - 1, static_cast<int>((entry.curvature - min_elevation) * scale));
+  std::sort(entries_.begin(), entries_.end(), [](const Entry &a, const Entry &b) {
+    if (a.ring != b.ring)
+      return a.ring < b.ring;
+    if (a.azimuth != b.azimuth)
+      return a.azimuth < b.azimuth;
+    return a.index < b.index;
+  });
+
+  // breaks_[j]: gaps between consecutive entries up to j, a window without gaps is continuous
+  const size_t n = entries_.size();
+  breaks_.assign(n, 0);
+  for (size_t j = 1; j < n; ++j)
+  {
+    const pcl::PointXYZI &a = scan.points[entries_[j - 1].index], &b = scan.points[entries_[j].index];
+    float step = (a.getVector3fMap() - b.getVector3fMap()).norm();
+    bool gap = entries_[j].ring != entries_[j - 1].ring || step > options_.max_step * entries_[j].range;
+    breaks_[j] = breaks_[j - 1] + (gap ? 1 : 0);
+  }
+  taken_.assign(n, false);
+
+  for (size_t begin = 0; begin < n;)
+  {
+    size_t end = begin;
+    while (end < n && entries_[end].ring == entries_[begin].ring)
+      ++end;
+    if (end - begin < static_cast<size_t>(2 * window + 1))
+    {
+      begin = end;
+      continue;
+    }
+
+    const size_t first = begin + window, last = end - window;
+    for (size_t j = first; j < last; ++j)
+    {
+      Entry &entry = entries_[j];
+      if (breaks_[j + window] != breaks_[j - window])
+      {
+        entry.curvature = -1.f;
+        continue;
+      }
+      Eigen::Vector3f offset = Eigen::Vector3f::Zero();
+      float length = 0.f;
+      const Eigen::Vector3f center = scan.points[entry.index].getVector3fMap();
+      for (int k = -window; k <= window; ++k)
+      {
+        Eigen::Vector3f d = scan.points[entries_[j + k].index].getVector3fMap() - center;
+        offset += d;
+        length += d.norm();
+      }
+      entry.curvature = length > 0.f ? offset.norm() / length : -1.f;
+    }
+
+    for (int s = 0; s < sectors; ++s)
+    {
+      size_t lo = first + (last - first) * s / sectors, hi = first + (last - first) * (s + 1) / sectors;
+      candidates_.clear();
+      for (size_t j = lo; j < hi; ++j)
+        if (entries_[j].curvature >= 0.f)
+          candidates_.push_back(static_cast<uint32_t>(j));
+      std::stable_sort(candidates_.begin(), candidates_.end(),
+                       [this](uint32_t a, uint32_t b) { return entries_[a].curvature < entries_[b].curvature; });
+
+      auto take = [&](uint32_t j, Cloud &out) {
+        out.push_back(scan.points[entries_[j].index]);
+        for (size_t k = j - window; k <= j + window; ++k)
+          taken_[k] = true;
+      };
+      int kept = 0;
+      for (auto it = candidates_.rbegin(); it != candidates_.rend() && kept < options_.edges_per_sector; ++it)
+      {
+        if (entries_[*it].curvature <= options_.edge_threshold)
+          break;
+        if (taken_[*it])
+          continue;
+        take(*it, edges);
+        ++kept;
+      }
+      kept = 0;
+      for (auto it = candidates_.begin(); it != candidates_.end() && kept < options_.planes_per_sector; ++it)
+      {
+        if (entries_[*it].curvature >= options_.plane_threshold)
+          break;
+        if (taken_[*it])
+          continue;
+        take(*it, planes);
+        ++kept;
+      }
+    }
+    begin = end;
+  }
+}
@@ -0,0 +1,386 @@
+#include "localization/scan_matcher.h"
+#include "localization/feature_matcher.h"
+#include "localization/parallel_icp.h"
+#include "localization/point_kernels.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <pcl/features/normal_3d_omp.h>
+#include <pcl/registration/gicp.h>
+#include <pcl/registration/icp.h>
+#include <pcl/registration/ndt.h>
+#include <pcl/registration/transformation_estimation_point_to_plane_lls.h>
+#include <pcl/search/kdtree.h>
+
+namespace
+{
+typedef pcl::search::KdTree<pcl::PointXYZI> Tree;
+
+/* Same measure as Registration::getFitnessScore(), also recording the inlier share */
+template <typename TreeT, typename PointT>
+double treeFitness(const TreeT &tree, const pcl::PointCloud<PointT> &aligned, double max_range, double &inlier_ratio)
+{
+  std::vector<int> index(1);
+  std::vector<float> d2(1);
+  double sum = 0;
+  size_t n = 0;
+  for (const PointT &p : aligned.points)
+  {
+    if (tree.nearestKSearch(p, 1, index, d2) < 1 || d2[0] > max_range)
+      continue;
+    sum += d2[0];
+    ++n;
+  }
+  inlier_ratio = aligned.empty() ? 0. : static_cast<double>(n) / aligned.size();
+  return n > 0 ? sum / n : std::numeric_limits<double>::max();
+}
+
+/* Exposes the iteration count PCL keeps protected */
+template <typename Base>
+class Exposed : public Base
+{
+public:
+  int iterations() const { return this->nr_iterations_; }
+};
+
+/* Point-to-point ICP, the target kd-tree is shared between clones */
+class IcpMatcher : public ScanMatcher
+{
+public:
+  void setTarget(const Cloud::ConstPtr &target) override
+  {
+    Tree::Ptr tree(new Tree);
+    tree->setInputCloud(target);
+    share(target, tree);
+  }
+
+  Ptr clone() const override
+  {
+    std::shared_ptr<IcpMatcher> copy(new IcpMatcher);
+    copy->share(target_, tree_);
+    return copy;
+  }
+
+  void align(const Cloud::ConstPtr &source, const Eigen::Matrix4f &guess, const Settings &settings) override
+  {
+    icp_.setInputSource(source);
+    icp_.setMaxCorrespondenceDistance(settings.max_distance);
+    icp_.setMaximumIterations(settings.iterations);
+    icp_.setTransformationEpsilon(settings.transformation_epsilon);
+    icp_.setEuclideanFitnessEpsilon(settings.fitness_epsilon);
+    icp_.align(aligned_, guess);
+  }
+
+  bool hasConverged() const override { return icp_.hasConverged(); }
+  Eigen::Matrix4f finalTransformation() const override { return icp_.getFinalTransformation(); }
+  int iterations() const override { return icp_.iterations(); }
+  double fitness(double max_range) override { return treeFitness(*tree_, aligned_, max_range, inlier_ratio_); }
+
+private:
+  void share(const Cloud::ConstPtr &target, const Tree::Ptr &tree)
+  {
+    target_ = target;
+    tree_ = tree;
+    icp_.setInputTarget(target_);
+    // the tree is already built, align() must not rebuild it
+    icp_.setSearchMethodTarget(tree_, true);
+  }
+
+  Tree::Ptr tree_;
+  Exposed<pcl::IterativeClosestPoint<pcl::PointXYZI, pcl::PointXYZI>> icp_;
+  Cloud aligned_;
+};
+
+/* Point-to-plane ICP, target normals are estimated once in setTarget() */
+class PlaneIcpMatcher : public ScanMatcher
+{
+public:
+  typedef pcl::PointCloud<pcl::PointXYZINormal> NormalCloud;
+  typedef pcl::search::KdTree<pcl::PointXYZINormal> NormalTree;
+
+  explicit PlaneIcpMatcher(int neighbors) : neighbors_(neighbors)
+  {
+    typedef pcl::registration::TransformationEstimationPointToPlaneLLS<pcl::PointXYZINormal, pcl::PointXYZINormal>
+        PointToPlane;
+    PointToPlane::Ptr estimation(new PointToPlane);
+    icp_.setTransformationEstimation(estimation);
+  }
+
+  void setTarget(const Cloud::ConstPtr &target) override
+  {
+    Tree::Ptr tree(new Tree);
+    tree->setInputCloud(target);
+    pcl::PointCloud<pcl::Normal> normals;
+    pcl::NormalEstimationOMP<pcl::PointXYZI, pcl::Normal> estimation;
+    estimation.setInputCloud(target);
+    estimation.setSearchMethod(tree);
+    estimation.setKSearch(neighbors_);
+    estimation.compute(normals);
+
+    // points without a stable normal would poison the linear solve
+    NormalCloud::Ptr with_normals(new NormalCloud);
+    with_normals->reserve(target->size());
+    for (size_t i = 0; i < target->size(); ++i)
+    {
+      const pcl::Normal &n = normals.points[i];
+      if (!std::isfinite(n.normal_x) || !std::isfinite(n.normal_y) || !std::isfinite(n.normal_z))
+        continue;
+      with_normals->push_back(toNormalPoint(target->points[i], n.normal_x, n.normal_y, n.normal_z));
+    }
+    with_normals->width = with_normals->size();
+    with_normals->height = 1;
+
+    NormalTree::Ptr normal_tree(new NormalTree);
+    normal_tree->setInputCloud(with_normals);
+    share(target, with_normals, normal_tree);
+  }
+
+  Ptr clone() const override
+  {
+    std::shared_ptr<PlaneIcpMatcher> copy(new PlaneIcpMatcher(neighbors_));
+    copy->share(target_, target_normals_, tree_);
+    return copy;
+  }
+
+  void align(const Cloud::ConstPtr &source, const Eigen::Matrix4f &guess, const Settings &settings) override
+  {
+    NormalCloud::Ptr input(new NormalCloud);
+    input->reserve(source->size());
+    for (const auto &p : source->points)
+      input->push_back(toNormalPoint(p, 0.f, 0.f, 0.f));
+    input->width = input->size();
+    input->height = 1;
+
+    icp_.setInputSource(input);
+    icp_.setMaxCorrespondenceDistance(settings.max_distance);
+    icp_.setMaximumIterations(settings.iterations);
+    icp_.setTransformationEpsilon(settings.transformation_epsilon);
+    icp_.setEuclideanFitnessEpsilon(settings.fitness_epsilon);
+    icp_.align(aligned_, guess);
+  }
+
+  bool hasConverged() const override { return icp_.hasConverged(); }
+  Eigen::Matrix4f finalTransformation() const override { return icp_.getFinalTransformation(); }
+  int iterations() const override { return icp_.iterations(); }
+  double fitness(double max_range) override { return treeFitness(*tree_, aligned_, max_range, inlier_ratio_); }
+
+private:
+  static pcl::PointXYZINormal toNormalPoint(const pcl::PointXYZI &p, float nx, float ny, float nz)
+  {
+    pcl::PointXYZINormal q;
+    q.x = p.x;
+    q.y = p.y;
+    q.z = p.z;
+    q.intensity = p.intensity;
+    q.normal_x = nx;
+    q.normal_y = ny;
+    q.normal_z = nz;
+    q.curvature = 0;
+    return q;
+  }
+
+  void share(const Cloud::ConstPtr &target, const NormalCloud::ConstPtr &target_normals,
+             const NormalTree::Ptr &tree)
+  {
+    target_ = target;
+    target_normals_ = target_normals;
+    tree_ = tree;
+    icp_.setInputTarget(target_normals_);
+    icp_.setSearchMethodTarget(tree_, true);
+  }
+
+  int neighbors_;
+  NormalCloud::ConstPtr target_normals_;
+  NormalTree::Ptr tree_;
+  Exposed<pcl::IterativeClosestPoint<pcl::PointXYZINormal, pcl::PointXYZINormal>> icp_;
+  NormalCloud aligned_;
+};
+
+/* Generalized ICP, target covariances are computed once in setTarget() */
+class GicpMatcher : public ScanMatcher
+{
+public:
+  typedef pcl::GeneralizedIterativeClosestPoint<pcl::PointXYZI, pcl::PointXYZI> Gicp;
+
+  void setTarget(const Cloud::ConstPtr &target) override
+  {
+    Tree::Ptr tree(new Tree);
+    tree->setInputCloud(target);
+    Gicp::MatricesVectorPtr covariances(new Gicp::MatricesVector);
+    gicp_.targetCovariances(target, tree, *covariances);
+    share(target, tree, covariances);
+  }
+
+  Ptr clone() const override
+  {
+    std::shared_ptr<GicpMatcher> copy(new GicpMatcher);
+    copy->share(target_, tree_, covariances_);
+    return copy;
+  }
+
+  void align(const Cloud::ConstPtr &source, const Eigen::Matrix4f &guess, const Settings &settings) override
+  {
+    gicp_.setInputSource(source);
+    gicp_.setMaxCorrespondenceDistance(settings.max_distance);
+    gicp_.setMaximumIterations(settings.iterations);
+    gicp_.setTransformationEpsilon(settings.transformation_epsilon);
+    gicp_.setEuclideanFitnessEpsilon(settings.fitness_epsilon);
+    gicp_.align(aligned_, guess);
+  }
+
+  bool hasConverged() const override { return gicp_.hasConverged(); }
+  Eigen::Matrix4f finalTransformation() const override { return gicp_.getFinalTransformation(); }
+  int iterations() const override { return gicp_.iterations(); }
+  double fitness(double max_range) override { return treeFitness(*tree_, aligned_, max_range, inlier_ratio_); }
+
+private:
+  class SharedGicp : public Gicp
+  {
+  public:
+    int iterations() const { return this->nr_iterations_; }
+    void targetCovariances(const Cloud::ConstPtr &target, const Tree::Ptr &tree, MatricesVector &out)
+    {
+      this->template computeCovariances<pcl::PointXYZI>(target, tree, out);
+    }
+  };
+
+  void share(const Cloud::ConstPtr &target, const Tree::Ptr &tree, const Gicp::MatricesVectorPtr &covariances)
+  {
+    target_ = target;
+    tree_ = tree;
+    covariances_ = covariances;
+    gicp_.setInputTarget(target_);
+    gicp_.setSearchMethodTarget(tree_, true);
+    // set after the target, setInputTarget() drops any covariances it had
+    gicp_.setTargetCovariances(covariances_);
+  }
+
+  Tree::Ptr tree_;
+  Gicp::MatricesVectorPtr covariances_;
+  SharedGicp gicp_;
+  Cloud aligned_;
+};
+
+/*
+ * NDT: the target is reduced to per-voxel Gaussians in setTarget(). No kd-tree over
+ * the target points is built; fitness is measured against the voxel means instead.
+ */
+class NdtMatcher : public ScanMatcher
+{
+public:
+  NdtMatcher(float resolution, double step_size) : resolution_(resolution), step_size_(step_size)
+  {
+    ndt_.setResolution(resolution_);
+    ndt_.setStepSize(step_size_);
+  }
+
+  void setTarget(const Cloud::ConstPtr &target) override
+  {
+    target_ = target;
+    ndt_.setInputTarget(target_);
+    // NDT searches its voxel cells, an empty tree keeps Registration from indexing the points
+    ndt_.setSearchMethodTarget(Tree::Ptr(new Tree), true);
+  }
+
+  /* NDT cells can not be shared read-only between PCL instances, so clones rebuild them */
+  Ptr clone() const override
+  {
+    std::shared_ptr<NdtMatcher> copy(new NdtMatcher(resolution_, step_size_));
+    if (target_)
+      copy->setTarget(target_);
+    return copy;
+  }
+
+  void align(const Cloud::ConstPtr &source, const Eigen::Matrix4f &guess, const Settings &settings) override
+  {
+    source_ = source;
+    ndt_.setInputSource(source);
+    ndt_.setMaximumIterations(settings.iterations);
+    ndt_.setTransformationEpsilon(settings.transformation_epsilon);
+    ndt_.align(aligned_, guess);
+  }
+
+  bool hasConverged() const override { return ndt_.hasConverged(); }
+  Eigen::Matrix4f finalTransformation() const override { return ndt_.getFinalTransformation(); }
+  int iterations() const override { return ndt_.getFinalNumIteration(); }
+  double fitness(double max_range) override { return ndt_.cellFitness(aligned_, max_range, inlier_ratio_); }
+
+private:
+  class CellNdt : public pcl::NormalDistributionsTransform<pcl::PointXYZI, pcl::PointXYZI>
+  {
+  public:
+    /* Mean squared distance to the mean of the cell each point falls in */
+    double cellFitness(const Cloud &aligned, double max_range, double &inlier_ratio)
+    {
+      double sum = 0;
+      size_t n = 0;
+      for (const auto &p : aligned.points)
+      {
+        pcl::PointXYZI q = p;
+        auto leaf = this->target_cells_.getLeaf(q);
+        if (!leaf)
+          continue;
+        double d = (leaf->getMean().template cast<float>() - p.getVector3fMap()).squaredNorm();
+        if (d <= max_range)
+        {
+          sum += d;
+          ++n;
+        }
+      }
+      inlier_ratio = aligned.empty() ? 0. : static_cast<double>(n) / aligned.size();
+      return n > 0 ? sum / n : std::numeric_limits<double>::max();
+    }
+  };
+
+  float resolution_;
+  double step_size_;
+  CellNdt ndt_;
+  Cloud::ConstPtr source_;
+  Cloud aligned_;
+};
+}
+
+ScanMatcher::Ptr createScanMatcher(const ScanMatcher::Options &options)
+{
+  if (options.type == "icp")
+    return std::make_shared<IcpMatcher>();
+  if (options.type == "icp_mt")
+    return std::make_shared<ParallelIcpMatcher>(options.pool);
+  if (options.type == "icp_ivox")
+    return std::make_shared<ParallelIcpMatcher>(options.pool, options.voxel_resolution, options.voxel_capacity);
+  if (options.type == "icp_plane")
+    return std::make_shared<PlaneIcpMatcher>(options.normal_neighbors);
+  if (options.type == "gicp")
+    return std::make_shared<GicpMatcher>();
+  if (options.type == "ndt")
+    return std::make_shared<NdtMatcher>(options.ndt_resolution, options.ndt_step_size);
+  if (options.type == "loam")
+    return std::make_shared<FeatureMatcher>(options.pool, options.normal_neighbors, options.features);
+  return nullptr;
+}
+
+Eigen::Matrix<double, 6, 6> registrationCovariance(const ScanMatcher::Cloud &source, const Eigen::Matrix4f &pose,
+                                                   double mse)
+{
+  // point-to-point Gauss-Newton Hessian, left perturbation J = [-[q]x, I] per aligned point;
+  // J^T J only depends on q, so the points are paired with themselves
+  PointBuffer points;
+  points.assign(source);
+  transformPoints(pose, points, points);
+  Eigen::Matrix<double, 6, 6> hessian;
+  Eigen::Matrix<double, 6, 1> gradient;
+  accumulatePointToPoint(points, points, points.size()).normalEquations(hessian, gradient);
+
+  Eigen::Matrix<double, 6, 6> covariance(Eigen::Matrix<double, 6, 6>::Identity() * 1e6);
+  Eigen::FullPivLU<Eigen::Matrix<double, 6, 6>> lu(hessian);
+  if (source.size() >= 6 && lu.isInvertible())
+    covariance = mse * lu.inverse();
+
+  // (rotation, translation) -> ROS order (x, y, z, roll, pitch, yaw)
+  Eigen::Matrix<double, 6, 6> reordered;
+  reordered << covariance.bottomRightCorner<3, 3>(), covariance.bottomLeftCorner<3, 3>(),
+               covariance.topRightCorner<3, 3>(), covariance.topLeftCorner<3, 3>();
+  return reordered;
+}
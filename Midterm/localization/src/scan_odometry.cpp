@@ -0,0 +1,81 @@
+#include "localization/scan_odometry.h"
+
+#include <algorithm>
+
+#include "localization/voxel_hash_filter.h"
+
+ScanOdometry::ScanOdometry(const Options &options, float leaf, const ScanMatcherFactory &factory, ThreadPool *pool)
+    : options_(options), leaf_(leaf), factory_(factory), pool_(pool)
+{
+}
+
+bool ScanOdometry::align(const Cloud::ConstPtr &scan, const Eigen::Matrix4f &guess,
+                         const ScanMatcher::Settings &settings, Match &match)
+{
+  if (!matcher_)
+    return false;
+  matcher_->align(scan, guess, settings);
+  match.pose = matcher_->finalTransformation();
+  match.converged = matcher_->hasConverged();
+  match.iterations = matcher_->iterations();
+  match.fitness = matcher_->fitness(settings.max_distance);
+  match.inlier_ratio = matcher_->inlierRatio();
+  return true;
+}
+
+bool ScanOdometry::addFrame(const Cloud &scan, const Eigen::Matrix4f &pose)
+{
+  if (!keyframes_.empty())
+  {
+    Eigen::Matrix4f motion = last_keyframe_.inverse() * pose;
+    float rotation = Eigen::AngleAxisf(Eigen::Matrix3f(motion.topLeftCorner<3, 3>())).angle();
+    if (motion.block<3, 1>(0, 3).norm() < options_.keyframe_distance && rotation < options_.keyframe_angle)
+      return false;
+  }
+
+  Cloud::Ptr keyframe(new Cloud);
+  keyframe->points.resize(scan.size());
+  const Eigen::Matrix3f R = pose.topLeftCorner<3, 3>();
+  const Eigen::Vector3f t = pose.block<3, 1>(0, 3);
+  for (size_t i = 0; i < scan.size(); ++i)
+  {
+    keyframe->points[i] = scan.points[i];
+    keyframe->points[i].getVector3fMap() = R * scan.points[i].getVector3fMap() + t;
+  }
+  keyframe->width = keyframe->points.size();
+  keyframe->height = 1;
+
+  keyframes_.push_back(keyframe);
+  while (keyframes_.size() > static_cast<size_t>(std::max(1, options_.keyframes)))
+    keyframes_.pop_front();
+  last_keyframe_ = pose;
+  rebuild();
+  return true;
+}
+
+void ScanOdometry::reset()
+{
+  keyframes_.clear();
+  matcher_.reset();
+  last_keyframe_.setIdentity();
+}
+
+/* Local target from all keyframes, overlaps thinned back to one point per voxel */
+void ScanOdometry::rebuild()
+{
+  Cloud merged;
+  size_t total = 0;
+  for (const Cloud::ConstPtr &keyframe : keyframes_)
+    total += keyframe->size();
+  merged.points.reserve(total);
+  for (const Cloud::ConstPtr &keyframe : keyframes_)
+    merged.points.insert(merged.points.end(), keyframe->points.begin(), keyframe->points.end());
+  merged.width = merged.points.size();
+  merged.height = 1;
+
+  Cloud::Ptr target(new Cloud);
+  VoxelHashFilter(pool_).filter(merged, leaf_, *target);
+  ScanMatcher::Ptr matcher = factory_();
+  matcher->setTarget(target);
+  matcher_ = matcher;
+}
@@ -0,0 +1,44 @@
+#include "localization/stage_stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+const double kMinSeconds = 1e-6;
+}
+
+void LatencyHistogram::add(double seconds)
+{
+  int bucket = 0;
+  if (seconds > kMinSeconds)
+    bucket = std::min(kBuckets - 1, static_cast<int>(std::log2(seconds / kMinSeconds) * kBucketsPerOctave));
+  ++buckets_[bucket];
+  ++count_;
+  sum_ += seconds;
+  max_ = std::max(max_, seconds);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+  for (int i = 0; i < kBuckets; ++i)
+    buckets_[i] += other.buckets_[i];
+  count_ += other.count_;
+  sum_ += other.sum_;
+  max_ = std::max(max_, other.max_);
+}
+
+double LatencyHistogram::percentile(double q) const
+{
+  if (count_ == 0)
+    return 0;
+  uint64_t rank = static_cast<uint64_t>(std::ceil(std::max(0.0, std::min(1.0, q)) * count_));
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets; ++i)
+  {
+    seen += buckets_[i];
+    if (seen >= std::max<uint64_t>(rank, 1))
+      return std::min(max_, kMinSeconds * std::exp2(static_cast<double>(i + 1) / kBucketsPerOctave));
+  }
+  return max_;
+}
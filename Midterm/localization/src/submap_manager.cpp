@@ -0,0 +1,201 @@
+#include "localization/submap_manager.h"
+
+#include <chrono>
+
+SubmapManager::SubmapManager(float radius, float update_distance, const ScanMatcherFactory &factory)
+    : radius_(radius), update_distance_(update_distance), factory_(factory)
+{
+}
+
+SubmapManager::~SubmapManager()
+{
+  if (pending_.valid())
+    pending_.wait();
+}
+
+SubmapManager::Source SubmapManager::mapSource(const Cloud::ConstPtr &map)
+{
+  return [map](const Eigen::Vector3f &center, float radius, Cloud &out) {
+    const float r2 = radius * radius;
+    for (const auto &p : map->points)
+    {
+      float dx = p.x - center.x(), dy = p.y - center.y();
+      if (dx * dx + dy * dy <= r2)
+        out.points.push_back(p);
+    }
+  };
+}
+
+void SubmapManager::setMap(const Cloud::ConstPtr &map)
+{
+  setSource(mapSource(map));
+}
+
+void SubmapManager::setStore(const MapTileStore::ConstPtr &store)
+{
+  setSource([store](const Eigen::Vector3f &center, float radius, Cloud &out) {
+    // whole tiles come back, crop them to the disc so windows that slide see exact edges
+    const size_t first = out.points.size();
+    store->loadNear(center.x(), center.y(), radius, out);
+    const float r2 = radius * radius;
+    size_t kept = first;
+    for (size_t i = first; i < out.points.size(); ++i)
+    {
+      float dx = out.points[i].x - center.x(), dy = out.points[i].y - center.y();
+      if (dx * dx + dy * dy <= r2)
+        out.points[kept++] = out.points[i];
+    }
+    out.points.resize(kept);
+  });
+}
+
+bool SubmapManager::mergeMap(const Cloud::ConstPtr &map, const ScanMatcher::TargetUpdate &patch)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  // a slide in flight edits the current matcher, let it land first
+  if (pending_.valid())
+  {
+    std::future<SubmapConstPtr> pending = std::move(pending_);
+    lock.unlock();
+    SubmapConstPtr next = pending.get();
+    lock.lock();
+    if (next && next->generation == generation_)
+      current_ = next;
+  }
+
+  source_ = mapSource(map);
+  ++generation_;
+  if (!current_ || !current_->matcher->supportsUpdates())
+  {
+    current_.reset();
+    return false;
+  }
+  std::shared_ptr<Submap> kept(new Submap(*current_));
+  kept->generation = generation_;
+  current_ = kept;
+  // the patch is cropped to this window, a slide must not move it before the edit lands
+  merging_ = true;
+  lock.unlock();
+
+  // only the patch points inside the current window
+  ScanMatcher::TargetUpdate edit = patch;
+  if (patch.insert)
+  {
+    Cloud::Ptr inside(new Cloud);
+    mapSource(patch.insert)(kept->center, radius_, *inside);
+    inside->width = inside->points.size();
+    inside->height = 1;
+    edit.insert = inside;
+  }
+  bool updated = kept->matcher->updateTarget(edit);
+  lock.lock();
+  merging_ = false;
+  return updated;
+}
+
+void SubmapManager::setSource(const Source &source)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  source_ = source;
+  ++generation_;
+  current_.reset();
+  // an in-flight build of the old map is dropped when it finishes
+}
+
+bool SubmapManager::update(const Eigen::Vector3f &position)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!source_)
+    return false;
+
+  bool swapped = false;
+  if (pending_.valid() && pending_.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+  {
+    SubmapConstPtr next = pending_.get();
+    if (next && next->generation == generation_)
+    {
+      current_ = next;
+      swapped = true;
+    }
+  }
+
+  if (!current_)
+  {
+    // nothing to match against yet, so the first window has to block
+    Source source = source_;
+    uint64_t generation = generation_;
+    lock.unlock();
+    SubmapConstPtr first = build(source, position, generation);
+    lock.lock();
+    if (generation != generation_)
+      return false;
+    current_ = first;
+    return true;
+  }
+
+  Eigen::Vector2f offset = (position - current_->center).head<2>();
+  if (!pending_.valid() && !merging_ && offset.norm() > update_distance_)
+  {
+    if (current_->matcher->supportsUpdates())
+      pending_ = std::async(std::launch::async, &SubmapManager::slide, this, source_, current_, position, generation_);
+    else
+      pending_ = std::async(std::launch::async, &SubmapManager::build, this, source_, position, generation_);
+  }
+  return swapped;
+}
+
+SubmapManager::SubmapConstPtr SubmapManager::current() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return current_;
+}
+
+SubmapManager::SubmapConstPtr SubmapManager::build(const Source &source, const Eigen::Vector3f &center,
+                                                   uint64_t generation) const
+{
+  Cloud::Ptr cloud(new Cloud);
+  source(center, radius_, *cloud);
+  cloud->width = cloud->points.size();
+  cloud->height = 1;
+
+  std::shared_ptr<Submap> submap(new Submap);
+  submap->center = center;
+  submap->generation = generation;
+  submap->points = cloud->size();
+  submap->slid = false;
+  submap->matcher = factory_();
+  submap->matcher->setTarget(cloud);
+  return submap;
+}
+
+SubmapManager::SubmapConstPtr SubmapManager::slide(const Source &source, const SubmapConstPtr &from,
+                                                   const Eigen::Vector3f &center, uint64_t generation) const
+{
+  // points already in the old window are in the target, only read the new ones
+  Cloud::Ptr entering(new Cloud);
+  source(center, radius_, *entering);
+  const float r2 = radius_ * radius_;
+  const Eigen::Vector2f old_center = from->center.head<2>();
+  size_t kept = 0;
+  for (size_t i = 0; i < entering->points.size(); ++i)
+  {
+    if ((entering->points[i].getVector3fMap().head<2>() - old_center).squaredNorm() > r2)
+      entering->points[kept++] = entering->points[i];
+  }
+  entering->points.resize(kept);
+  entering->width = kept;
+  entering->height = 1;
+
+  ScanMatcher::TargetUpdate edit;
+  edit.insert = entering;
+  edit.keep_center = center.head<2>();
+  edit.keep_radius = radius_;
+  from->matcher->updateTarget(edit);
+
+  std::shared_ptr<Submap> submap(new Submap(*from));
+  submap->center = center;
+  submap->generation = generation;
+  submap->points = kept;
+  submap->slid = true;
+  return submap;
+}
@@ -0,0 +1,127 @@
+#include "localization/voxel_hash_filter.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+const size_t kChunk = 4096;
+const size_t kBuckets = 64;
+const uint8_t kInvalid = 0xFF;
+
+struct Voxel
+{
+  float x, y, z, intensity;
+  uint32_t count;
+};
+
+template <class F>
+void run(ThreadPool *pool, size_t n, const F &f)
+{
+  if (pool && n > 1)
+  {
+    pool->parallelFor(n, f);
+    return;
+  }
+  for (size_t i = 0; i < n; ++i)
+    f(i);
+}
+}
+
+void VoxelHashFilter::filter(const Cloud &in, float leaf, Cloud &out) const
+{
+  const size_t n = in.points.size();
+  const float inv_leaf = 1.f / leaf;
+  const size_t chunks = (n + kChunk - 1) / kChunk;
+
+  // 1. voxel key and bucket of every point, counted per chunk
+  std::vector<VoxelKey> keys(n);
+  std::vector<uint8_t> buckets(n);
+  std::vector<uint32_t> counts(chunks * kBuckets, 0);
+  run(pool_, chunks, [&](size_t c) {
+    uint32_t *count = &counts[c * kBuckets];
+    for (size_t i = c * kChunk, end = std::min(n, i + kChunk); i < end; ++i)
+    {
+      const pcl::PointXYZI &p = in.points[i];
+      if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z) ||
+          !VoxelKey::of(p.x, p.y, p.z, inv_leaf, keys[i]))
+      {
+        buckets[i] = kInvalid;
+        continue;
+      }
+      buckets[i] = VoxelKeyHash()(keys[i]) % kBuckets;
+      ++count[buckets[i]];
+    }
+  });
+
+  // 2. stable scatter of point indices into bucket order
+  std::vector<size_t> bucket_begin(kBuckets + 1, 0);
+  std::vector<uint32_t> offsets(chunks * kBuckets);
+  size_t total = 0;
+  for (size_t b = 0; b < kBuckets; ++b)
+  {
+    bucket_begin[b] = total;
+    for (size_t c = 0; c < chunks; ++c)
+    {
+      offsets[c * kBuckets + b] = total;
+      total += counts[c * kBuckets + b];
+    }
+  }
+  bucket_begin[kBuckets] = total;
+
+  std::vector<uint32_t> order(total);
+  run(pool_, chunks, [&](size_t c) {
+    uint32_t *offset = &offsets[c * kBuckets];
+    for (size_t i = c * kChunk, end = std::min(n, i + kChunk); i < end; ++i)
+      if (buckets[i] != kInvalid)
+        order[offset[buckets[i]]++] = i;
+  });
+
+  // 3. every bucket owns its voxels, so buckets reduce independently
+  std::vector<std::vector<Voxel>> voxels(kBuckets);
+  run(pool_, kBuckets, [&](size_t b) {
+    std::unordered_map<VoxelKey, uint32_t, VoxelKeyHash> index;
+    index.reserve((bucket_begin[b + 1] - bucket_begin[b]) / 4 + 1);
+    std::vector<Voxel> &bucket = voxels[b];
+    for (size_t j = bucket_begin[b]; j < bucket_begin[b + 1]; ++j)
+    {
+      const pcl::PointXYZI &p = in.points[order[j]];
+      auto inserted = index.emplace(keys[order[j]], static_cast<uint32_t>(bucket.size()));
+      if (inserted.second)
+      {
+        bucket.push_back(Voxel{p.x, p.y, p.z, p.intensity, 1});
+        continue;
+      }
+      Voxel &v = bucket[inserted.first->second];
+      v.x += p.x;
+      v.y += p.y;
+      v.z += p.z;
+      v.intensity += p.intensity;
+      ++v.count;
+    }
+  });
+
+  size_t occupied = 0;
+  for (const std::vector<Voxel> &bucket : voxels)
+    occupied += bucket.size();
+
+  pcl::PCLHeader header = in.header;
+  out.points.resize(occupied);
+  size_t k = 0;
+  for (const std::vector<Voxel> &bucket : voxels)
+  {
+    for (const Voxel &v : bucket)
+    {
+      const float inv = 1.f / v.count;
+      pcl::PointXYZI &p = out.points[k++];
+      p.x = v.x * inv;
+      p.y = v.y * inv;
+      p.z = v.z * inv;
+      p.intensity = v.intensity * inv;
+    }
+  }
+  out.header = header;
+  out.width = out.points.size();
+  out.height = 1;
+  out.is_dense = true;
+}
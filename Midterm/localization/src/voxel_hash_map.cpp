@@ -0,0 +1,226 @@
+#include "localization/voxel_hash_map.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+VoxelHashMap::VoxelHashMap(float resolution, size_t capacity)
+    : resolution_(resolution), inv_resolution_(1.f / resolution), capacity_(std::max<size_t>(capacity, 1))
+{
+}
+
+size_t VoxelHashMap::insert(const Cloud &cloud)
+{
+  std::lock_guard<std::shared_timed_mutex> lock(mutex_);
+  return insertLocked(cloud);
+}
+
+size_t VoxelHashMap::removeBox(const Eigen::AlignedBox3f &box)
+{
+  std::lock_guard<std::shared_timed_mutex> lock(mutex_);
+  return removeBoxLocked(box);
+}
+
+size_t VoxelHashMap::removeOutside(const Eigen::Vector2f &center, float radius)
+{
+  std::lock_guard<std::shared_timed_mutex> lock(mutex_);
+  return removeOutsideLocked(center, radius);
+}
+
+void VoxelHashMap::apply(const std::vector<Eigen::AlignedBox3f> &remove, const Eigen::Vector2f &keep_center,
+                         float keep_radius, const Cloud *insert)
+{
+  std::lock_guard<std::shared_timed_mutex> lock(mutex_);
+  for (const Eigen::AlignedBox3f &box : remove)
+    removeBoxLocked(box);
+  if (keep_radius > 0)
+    removeOutsideLocked(keep_center, keep_radius);
+  if (insert)
+    insertLocked(*insert);
+}
+
+size_t VoxelHashMap::insertLocked(const Cloud &cloud)
+{
+  size_t added = 0;
+  VoxelKey key;
+  for (const pcl::PointXYZI &p : cloud.points)
+  {
+    if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z) ||
+        !VoxelKey::of(p.x, p.y, p.z, inv_resolution_, key))
+      continue;
+    std::vector<Eigen::Vector3f> &points = voxels_[key].points;
+    if (points.size() >= capacity_)
+      continue;
+    points.push_back(p.getVector3fMap());
+    ++added;
+  }
+  size_ += added;
+  return added;
+}
+
+template <typename Candidate, typename Remove>
+size_t VoxelHashMap::removeIf(const Candidate &candidate, const Remove &remove)
+{
+  size_t removed = 0;
+  for (Table::iterator it = voxels_.begin(); it != voxels_.end();)
+  {
+    if (!candidate(it->first))
+    {
+      ++it;
+      continue;
+    }
+    std::vector<Eigen::Vector3f> &points = it->second.points;
+    const size_t before = points.size();
+    points.erase(std::remove_if(points.begin(), points.end(), remove), points.end());
+    removed += before - points.size();
+    it = points.empty() ? voxels_.erase(it) : std::next(it);
+  }
+  size_ -= removed;
+  compact();
+  return removed;
+}
+
+size_t VoxelHashMap::removeBoxLocked(const Eigen::AlignedBox3f &box)
+{
+  if (box.isEmpty())
+    return 0;
+  VoxelKey lo = {0, 0, 0}, hi = {0, 0, 0};
+  const Eigen::Vector3f &a = box.min(), &b = box.max();
+  const bool bounded = VoxelKey::of(a.x(), a.y(), a.z(), inv_resolution_, lo) &&
+                       VoxelKey::of(b.x(), b.y(), b.z(), inv_resolution_, hi);
+  auto inside = [&box](const Eigen::Vector3f &p) { return box.contains(p); };
+
+  // small boxes look up their voxels, large ones scan the table
+  const double cells = bounded ? (static_cast<double>(hi.x) - lo.x + 1) * (static_cast<double>(hi.y) - lo.y + 1) *
+                                     (static_cast<double>(hi.z) - lo.z + 1)
+                               : std::numeric_limits<double>::max();
+  if (cells >= static_cast<double>(voxels_.size()))
+    return removeIf(
+        [&](const VoxelKey &k) {
+          return !bounded || (k.x >= lo.x && k.x <= hi.x && k.y >= lo.y && k.y <= hi.y && k.z >= lo.z && k.z <= hi.z);
+        },
+        inside);
+
+  size_t removed = 0;
+  VoxelKey k;
+  for (k.x = lo.x; k.x <= hi.x; ++k.x)
+    for (k.y = lo.y; k.y <= hi.y; ++k.y)
+      for (k.z = lo.z; k.z <= hi.z; ++k.z)
+      {
+        Table::iterator it = voxels_.find(k);
+        if (it == voxels_.end())
+          continue;
+        std::vector<Eigen::Vector3f> &points = it->second.points;
+        const size_t before = points.size();
+        points.erase(std::remove_if(points.begin(), points.end(), inside), points.end());
+        removed += before - points.size();
+        if (points.empty())
+          voxels_.erase(it);
+      }
+  size_ -= removed;
+  compact();
+  return removed;
+}
+
+size_t VoxelHashMap::removeOutsideLocked(const Eigen::Vector2f &center, float radius)
+{
+  const float r2 = radius * radius;
+  // voxels whose XY square lies inside the disc are kept without looking at their points
+  const float half_diagonal = resolution_ * 0.70710678f;
+  const float inner = std::max(0.f, radius - half_diagonal);
+  return removeIf(
+      [&](const VoxelKey &k) {
+        Eigen::Vector2f offset((k.x + 0.5f) * resolution_ - center.x(), (k.y + 0.5f) * resolution_ - center.y());
+        return offset.squaredNorm() > inner * inner;
+      },
+      [&](const Eigen::Vector3f &p) { return (p.head<2>() - center).squaredNorm() > r2; });
+}
+
+void VoxelHashMap::clear()
+{
+  std::lock_guard<std::shared_timed_mutex> lock(mutex_);
+  Table().swap(voxels_);
+  size_ = 0;
+}
+
+void VoxelHashMap::compact()
+{
+  // lazy: only once most buckets are empty, so alternating edits do not rehash every time
+  if (voxels_.bucket_count() > 64 && voxels_.size() * 4 < voxels_.bucket_count())
+    voxels_.rehash(0);
+}
+
+bool VoxelHashMap::nearest(const Eigen::Vector3f &query, float max_distance, Eigen::Vector3f &point,
+                           float &d2) const
+{
+  VoxelKey center;
+  if (!VoxelKey::of(query.x(), query.y(), query.z(), inv_resolution_, center))
+    return false;
+
+  // distance from the query to the nearest face of its own voxel
+  float gap = resolution_;
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    const int32_t index = axis == 0 ? center.x : axis == 1 ? center.y : center.z;
+    const float offset = query[axis] - index * resolution_;
+    gap = std::min(gap, std::min(offset, resolution_ - offset));
+  }
+  // keyed in double, so allow for the float rounding of the offsets
+  gap = std::max(gap - 1e-4f * resolution_, 0.f);
+
+  const float max_d2 = max_distance * max_distance;
+  // an unbounded search still stops a kilometer-scale distance out
+  const int shells = static_cast<int>(std::min(std::ceil(max_distance * inv_resolution_), 1024.f));
+  float best = max_d2;
+  bool found = false;
+  for (int s = 0; s <= shells; ++s)
+  {
+    // points in shell s are at least this far from the query
+    if (s > 0)
+    {
+      const float reach = (s - 1) * resolution_ + gap;
+      if (reach * reach > best)
+        break;
+    }
+    VoxelKey k;
+    for (int dx = -s; dx <= s; ++dx)
+      for (int dy = -s; dy <= s; ++dy)
+      {
+        const bool side = std::abs(dx) == s || std::abs(dy) == s;
+        // inside the shell only the top and bottom faces are part of it
+        for (int dz = -s; dz <= s; dz += side || s == 0 ? 1 : 2 * s)
+        {
+          k.x = center.x + dx;
+          k.y = center.y + dy;
+          k.z = center.z + dz;
+          Table::const_iterator it = voxels_.find(k);
+          if (it == voxels_.end())
+            continue;
+          for (const Eigen::Vector3f &p : it->second.points)
+          {
+            const float d = (p - query).squaredNorm();
+            if (d < best || (!found && d <= best))
+            {
+              best = d;
+              point = p;
+              found = true;
+            }
+          }
+        }
+      }
+  }
+  d2 = best;
+  return found;
+}
+
+size_t VoxelHashMap::size() const
+{
+  std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+  return size_;
+}
+
+size_t VoxelHashMap::voxelCount() const
+{
+  std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+  return voxels_.size();
+}
@@ -0,0 +1,152 @@
+/*
+ * Several LocalizerCores on one shared map, run concurrently like localizer_bench
+ * sequences. Each vehicle is carried off to another pose, the health check rejects the
+ * jump until the core counts as lost and relocalizes around the new GPS fix. Every core
+ * has to find its pose again; a relocalization that waits on its own pool hangs.
+ */
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "localization/localizer_core.h"
+
+namespace
+{
+typedef LocalizerCore::Cloud Cloud;
+
+/* Wavy ground with two walls, enough structure for a unique yaw */
+Cloud::ConstPtr makeMap()
+{
+  Cloud::Ptr map(new Cloud);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> u(-10, 10);
+  pcl::PointXYZI p;
+  p.intensity = 0;
+  for (int i = 0; i < 3000; ++i)
+  {
+    p.x = u(rng);
+    p.y = u(rng);
+    p.z = std::sin(p.x) * std::cos(p.y);
+    map->push_back(p);
+  }
+  for (int i = 0; i < 1000; ++i)
+  {
+    p.x = u(rng);
+    p.y = 10;
+    p.z = 0.3f * u(rng) + 3;
+    map->push_back(p);
+    p.x = 10;
+    p.y = u(rng);
+    map->push_back(p);
+  }
+  return map;
+}
+
+LocalizerCore::Options options(int threads)
+{
+  LocalizerCore::Options o;
+  o.matcher.type = "icp_mt";
+  o.threads = threads;
+  o.scan_leaf = 0.1;
+  o.map_leaf = 0.1;
+  o.fixed_init_yaw = true;
+  o.init_yaw = 0;
+  AdaptiveBudget::Level level;
+  level.leaf = 0.1;
+  level.settings.max_distance = 2;
+  level.settings.iterations = 50;
+  o.pyramid.push_back(level);
+  o.health_check = true;
+  o.relocalization.yaw_step = 0.5;
+  o.relocalization.coarse_iterations = 30;
+  o.relocalization.fine_iterations = 100;
+  return o;
+}
+
+/* The scan of `map` seen from `pose` */
+Cloud scanAt(const Cloud &map, const Eigen::Matrix4f &pose)
+{
+  Eigen::Matrix4f inverse = pose.inverse();
+  Cloud scan;
+  for (size_t i = 0; i < map.size(); i += 3)
+  {
+    pcl::PointXYZI p = map.points[i];
+    p.getVector3fMap() = inverse.topLeftCorner<3, 3>() * p.getVector3fMap() + inverse.topRightCorner<3, 1>();
+    scan.push_back(p);
+  }
+  return scan;
+}
+
+/*
+ * Replays a vehicle standing at the origin that is moved to `kidnapped` from frame 5 on.
+ * True once a frame there is matched at the right pose, false if none is before `deadline`.
+ */
+bool replay(const Cloud::ConstPtr &map, int threads, const Eigen::Matrix4f &kidnapped,
+            std::chrono::steady_clock::time_point deadline)
+{
+  LocalizerCore core(options(threads));
+  core.setMap(*map);
+  core.setGps(Eigen::Vector3f::Zero());
+
+  for (int k = 0; std::chrono::steady_clock::now() < deadline; ++k)
+  {
+    Eigen::Matrix4f pose = Eigen::Matrix4f::Identity();
+    if (k >= 5)
+    {
+      pose = kidnapped;
+      core.setGps(kidnapped.block<3, 1>(0, 3));
+    }
+    Cloud::Ptr scan = core.acquireScan();
+    core.preprocess(RawCloudView::fromCloud(scanAt(*map, pose)), 0.1 * k, *scan);
+    LocalizerCore::Result result = core.align(scan, 0.1 * k);
+    if (k >= 5 && result.matched)
+      return (result.pose - pose).norm() < 0.05f;
+    // give the relocalization running on the pool time to finish
+    if (k >= 5)
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  return false;
+}
+} // namespace
+
+TEST(BatchRelocalization, ConcurrentCoresRecoverFromLoss)
+{
+  Cloud::ConstPtr map = makeMap();
+  // one worker as with threads: 1 or a single-core host, two as the batch bench floor
+  const std::vector<int> threads{1, 2, 2};
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(120);
+
+  // detached so that a hung sequence fails the test instead of blocking it
+  std::vector<std::future<bool>> sequences;
+  for (size_t i = 0; i < threads.size(); ++i)
+  {
+    std::shared_ptr<std::promise<bool>> done = std::make_shared<std::promise<bool>>();
+    sequences.push_back(done->get_future());
+    int count = threads[i];
+    // 5 m away, more than max_jump, on a yaw of the relocalization grid
+    Eigen::Matrix4f kidnapped = Eigen::Matrix4f::Identity();
+    kidnapped.topLeftCorner<3, 3>() = Eigen::AngleAxisf(0.5f * (i + 1), Eigen::Vector3f::UnitZ()).matrix();
+    kidnapped.block<3, 1>(0, 3) = Eigen::Vector3f(4, 3, 0);
+    std::thread([done, map, count, kidnapped, deadline]() {
+      done->set_value(replay(map, count, kidnapped, deadline));
+    }).detach();
+  }
+  for (size_t i = 0; i < sequences.size(); ++i)
+  {
+    ASSERT_EQ(sequences[i].wait_for(std::chrono::seconds(150)), std::future_status::ready)
+        << "sequence " << i << " with " << threads[i] << " threads hung";
+    EXPECT_TRUE(sequences[i].get()) << "sequence " << i << " did not relocalize";
+  }
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}